@@ -184,11 +184,37 @@ struct nrsc5_event_t
 typedef struct nrsc5_event_t nrsc5_event_t;
 
 typedef void (*nrsc5_callback_t)(const nrsc5_event_t *evt, void *opaque);
+// returns non-zero to stop a batch decode
+typedef int (*nrsc5_cancel_t)(void *opaque);
+
+enum
+{
+    NRSC5_SCAN_NONE,
+    NRSC5_SCAN_ANALOG,
+    NRSC5_SCAN_HYBRID
+};
+
+/*
+ * Station found by a scan. The carrier to noise ratio (dB) is measured on
+ * the digital sidebands for hybrid stations, and on the analog carrier
+ * otherwise. Time is the number of seconds of samples it took to reach the
+ * classification.
+ */
+struct nrsc5_scan_result_t
+{
+    float freq;
+    int type;
+    float cnr;
+    float time;
+};
+typedef struct nrsc5_scan_result_t nrsc5_scan_result_t;
 
 /*
  * Opaque data types.
  */
 typedef struct nrsc5_t nrsc5_t;
+typedef struct nrsc5_channelizer_t nrsc5_channelizer_t;
+typedef struct nrsc5_scan_t nrsc5_scan_t;
 
 /*
  * Public functions. All functions return void or an error code (0 == success).
@@ -205,8 +231,68 @@ int nrsc5_set_frequency(nrsc5_t *, float freq);
 void nrsc5_get_gain(nrsc5_t *, float *gain);
 int nrsc5_set_gain(nrsc5_t *, float gain);
 void nrsc5_set_auto_gain(nrsc5_t *, int enabled);
+void nrsc5_get_dropped_frames(nrsc5_t *, unsigned int *count);
+/*
+ * Report NRSC5_EVENT_BER for one P1 frame in every 'interval' (default 1).
+ * Zero disables the channel BER estimate altogether.
+ */
+void nrsc5_set_ber_interval(nrsc5_t *, unsigned int interval);
+/*
+ * Sample buffering for RTL-SDR devices, set while stopped. Samples are read
+ * into usb_count transfers of usb_length bytes (a multiple of 512), then
+ * queued in a ring of at least ring_size bytes for decoding. Transfers that
+ * arrive while the ring is full are dropped and counted as overruns.
+ * Defaults are a 16 MiB ring and 8 transfers of 512 KiB.
+ */
+int nrsc5_set_buffers(nrsc5_t *, unsigned int ring_size, unsigned int usb_count, unsigned int usb_length);
+void nrsc5_get_ring_stats(nrsc5_t *, unsigned int *overruns, unsigned int *high_water);
 void nrsc5_set_callback(nrsc5_t *, nrsc5_callback_t callback, void *opaque);
 int nrsc5_pipe_samples_cu8(nrsc5_t *, uint8_t *samples, unsigned int length);
 int nrsc5_pipe_samples_cs16(nrsc5_t *, int16_t *samples, unsigned int length);
+int nrsc5_pipe_samples_cs8(nrsc5_t *, int8_t *samples, unsigned int length);
+int nrsc5_pipe_samples_cf32(nrsc5_t *, float *samples, unsigned int length);
+/*
+ * Input sample rate of piped samples and IQ files, set while stopped. By
+ * default (zero), cu8 samples are expected at 1488375 S/s and cs16 samples
+ * already decimated to 744187.5 S/s, while cs8 and cf32 samples are
+ * resampled from 1488375 S/s. Any other rate of at least 744188 S/s is
+ * resampled, for all formats.
+ */
+int nrsc5_set_sample_rate(nrsc5_t *, unsigned int sample_rate);
+
+/*
+ * Batch decoding of an IQ file, from its current position to the end. The
+ * file must be seekable. Segments of the file are decoded in parallel by up
+ * to 'threads' receivers, and their events are passed to callback on the
+ * calling thread in the order of the file. NRSC5_EVENT_IQ is not reported.
+ * If cancel is not NULL, it is polled on the calling thread between events
+ * and while waiting, and decoding stops soon after it returns non-zero.
+ * Returns non-zero if the file could not be read or memory ran out.
+ */
+int nrsc5_decode_file(FILE *fp, unsigned int threads, nrsc5_callback_t callback, void *opaque, nrsc5_cancel_t cancel);
+
+/*
+ * Wideband input. Samples are captured at sample_rate around center_freq, and
+ * each added station is decoded by its own pipe-mode receiver. The returned
+ * receivers are owned by the channelizer and closed by nrsc5_channelizer_close.
+ */
+int nrsc5_channelizer_open(nrsc5_channelizer_t **, unsigned int sample_rate, float center_freq);
+void nrsc5_channelizer_close(nrsc5_channelizer_t *);
+int nrsc5_channelizer_add_station(nrsc5_channelizer_t *, float freq, nrsc5_t **radio);
+int nrsc5_channelizer_pipe_samples_cs16(nrsc5_channelizer_t *, int16_t *samples, unsigned int length);
+int nrsc5_channelizer_pipe_samples_cf32(nrsc5_channelizer_t *, float *samples, unsigned int length);
+
+/*
+ * Band scan. nrsc5_scan sweeps an RTL-SDR across the band while it is stopped.
+ * Captures are scanned by piping their samples, after which results holds up
+ * to count stations, ranked with the strongest hybrid stations first.
+ */
+int nrsc5_scan(nrsc5_t *, nrsc5_scan_result_t *results, unsigned int *count);
+int nrsc5_scan_open(nrsc5_scan_t **, unsigned int sample_rate, float center_freq);
+void nrsc5_scan_close(nrsc5_scan_t *);
+int nrsc5_scan_pipe_samples_cu8(nrsc5_scan_t *, uint8_t *samples, unsigned int length);
+int nrsc5_scan_pipe_samples_cs16(nrsc5_scan_t *, int16_t *samples, unsigned int length);
+int nrsc5_scan_pipe_samples_cf32(nrsc5_scan_t *, float *samples, unsigned int length);
+void nrsc5_scan_get_results(nrsc5_scan_t *, nrsc5_scan_result_t *results, unsigned int *count);
 
 #endif /* NRSC5_H_ */
@@ -13,9 +13,23 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "config.h"
+
 #include <math.h>
 #include <string.h>
 
+#ifdef HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+#ifdef HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef HAVE_AVX2_DISPATCH
+#include <immintrin.h>
+#endif
+
 #include "acquire.h"
 #include "defines.h"
 #include "input.h"
@@ -57,15 +71,137 @@ static float filter_taps[] = {
     0
 };
 
-void acquire_process(acquire_t *st)
+/*
+ * Correlation of each sample with the sample one FFT later, summed over all
+ * symbols. The cyclic prefix makes this correlation peak at the start of
+ * each symbol. The products x * conj(y) are accumulated in two parts,
+ * x * re(y) and x * im(y), and combined once at the end.
+ */
+static void corr_generic(const float complex *buffer, float complex *sums)
 {
-    float complex max_v = 0, phase_increment;
+    unsigned int i, j;
+
+    for (i = 0; i < FFTCP; ++i)
+    {
+        float complex sum = 0;
+        for (j = 0; j < ACQUIRE_SYMBOLS; ++j)
+            sum += buffer[i + j * FFTCP] * conjf(buffer[i + j * FFTCP + FFT]);
+        sums[i] = sum;
+    }
+}
+
+#ifdef HAVE_SSE2
+static void corr_sse2(const float complex *buffer, float complex *sums)
+{
+    const float *b = (const float *) buffer;
+    unsigned int i, j;
+
+    for (i = 0; i + 2 <= FFTCP; i += 2)
+    {
+        __m128 re = _mm_setzero_ps(), im = _mm_setzero_ps();
+
+        for (j = 0; j < ACQUIRE_SYMBOLS; ++j)
+        {
+            __m128 x = _mm_loadu_ps(&b[(i + j * FFTCP) * 2]);
+            __m128 y = _mm_loadu_ps(&b[(i + j * FFTCP + FFT) * 2]);
+            re = _mm_add_ps(re, _mm_mul_ps(x, _mm_shuffle_ps(y, y, _MM_SHUFFLE(2, 2, 0, 0))));
+            im = _mm_add_ps(im, _mm_mul_ps(x, _mm_shuffle_ps(y, y, _MM_SHUFFLE(3, 3, 1, 1))));
+        }
+
+        // (re.r + im.i, re.i - im.r)
+        im = _mm_shuffle_ps(im, im, _MM_SHUFFLE(2, 3, 0, 1));
+        im = _mm_xor_ps(im, _mm_castsi128_ps(_mm_set_epi32(0x80000000, 0, 0x80000000, 0)));
+        _mm_storeu_ps((float *) &sums[i], _mm_add_ps(re, im));
+    }
+}
+#endif
+
+#ifdef HAVE_NEON
+static void corr_neon(const float complex *buffer, float complex *sums)
+{
+    const float *b = (const float *) buffer;
+    unsigned int i, j;
+
+    for (i = 0; i + 4 <= FFTCP; i += 4)
+    {
+        float32x4x2_t sum;
+        float32x4_t re = vdupq_n_f32(0), im = vdupq_n_f32(0);
+
+        for (j = 0; j < ACQUIRE_SYMBOLS; ++j)
+        {
+            float32x4x2_t x = vld2q_f32(&b[(i + j * FFTCP) * 2]);
+            float32x4x2_t y = vld2q_f32(&b[(i + j * FFTCP + FFT) * 2]);
+            re = vmlaq_f32(re, x.val[0], y.val[0]);
+            re = vmlaq_f32(re, x.val[1], y.val[1]);
+            im = vmlaq_f32(im, x.val[1], y.val[0]);
+            im = vmlsq_f32(im, x.val[0], y.val[1]);
+        }
+
+        sum.val[0] = re;
+        sum.val[1] = im;
+        vst2q_f32((float *) &sums[i], sum);
+    }
+}
+#endif
+
+#ifdef HAVE_AVX2_DISPATCH
+__attribute__((target("avx2")))
+static void corr_avx2(const float complex *buffer, float complex *sums)
+{
+    const float *b = (const float *) buffer;
+    unsigned int i, j;
+
+    for (i = 0; i + 4 <= FFTCP; i += 4)
+    {
+        __m256 re = _mm256_setzero_ps(), im = _mm256_setzero_ps();
+
+        for (j = 0; j < ACQUIRE_SYMBOLS; ++j)
+        {
+            __m256 x = _mm256_loadu_ps(&b[(i + j * FFTCP) * 2]);
+            __m256 y = _mm256_loadu_ps(&b[(i + j * FFTCP + FFT) * 2]);
+            re = _mm256_add_ps(re, _mm256_mul_ps(x, _mm256_moveldup_ps(y)));
+            im = _mm256_add_ps(im, _mm256_mul_ps(x, _mm256_movehdup_ps(y)));
+        }
+
+        // (re.r + im.i, re.i - im.r)
+        im = _mm256_permute_ps(im, _MM_SHUFFLE(2, 3, 0, 1));
+        im = _mm256_xor_ps(im, _mm256_castsi256_ps(_mm256_set1_epi64x(0x8000000000000000)));
+        _mm256_storeu_ps((float *) &sums[i], _mm256_add_ps(re, im));
+    }
+}
+#endif
+
+/*
+ * Convert, derotate and window samples into the FFT input. The conjugate of
+ * each sample is taken, as in cq15_to_cf_conj, and multiplied by
+ * phase * nco[j]. The tail of each symbol is added onto its cyclic prefix.
+ */
+static void mix(const cint16_t *x, const float complex *nco, float complex phase, unsigned int len, float complex *y, int add)
+{
+    const float pr = crealf(phase), pi = cimagf(phase);
+
+    for (unsigned int j = 0; j < len; ++j)
+    {
+        float nr = crealf(nco[j]) * pr - cimagf(nco[j]) * pi;
+        float ni = crealf(nco[j]) * pi + cimagf(nco[j]) * pr;
+        float xr = x[j].r, xi = -x[j].i;
+        float complex v = CMPLXF(xr * nr - xi * ni, xr * ni + xi * nr);
+
+        if (add)
+            y[j] += v;
+        else
+            y[j] = v;
+    }
+}
+
+// Process ACQUIRE_LEN samples from 'in', and return the number consumed. The
+// rest must be passed again at the start of the next call.
+unsigned int acquire_process(acquire_t *st, const cint16_t *in)
+{
+    float complex max_v = 0, symbol_increment;
     float angle, angle_diff, angle_factor, max_mag = -1.0f;
     int samperr = 0;
-    unsigned int i, j, keep;
-
-    if (st->idx != FFTCP * (ACQUIRE_SYMBOLS + 1))
-        return;
+    unsigned int i, j;
 
     if (st->input->sync_state == SYNC_STATE_FINE)
     {
@@ -79,27 +215,36 @@ void acquire_process(acquire_t *st)
     }
     else
     {
-        cint16_t y;
-        for (i = 0; i < FFTCP * (ACQUIRE_SYMBOLS + 1); i++)
+        // the window applied to the correlation is shape[j] * shape[j + FFT]
+        // = sin(theta * j) / 2, with theta = pi / CP. Its sum over a sliding
+        // range of lags is (a - b) / 4i, where a and b are sliding sums
+        // weighted by exp(i * theta * j) and exp(-i * theta * j).
+        const double complex rot = cexp(I * M_PI / CP);
+        double complex a = 0, b = 0;
+
+        for (i = 0; i < ACQUIRE_SYMBOLS + 1; i++)
         {
-            fir_q15_execute(st->filter, &st->in_buffer[i], &y);
-            st->buffer[i] = cq15_to_cf_conj(y);
+            fir_q15_execute_block(st->filter, &in[i * FFTCP], FFTCP, st->filtered);
+            for (j = 0; j < FFTCP; j++)
+                st->buffer[i * FFTCP + j] = cq15_to_cf_conj(st->filtered[j]);
         }
 
-        memset(st->sums, 0, sizeof(float complex) * FFTCP);
-        for (i = 0; i < FFTCP; ++i)
+        st->corr(st->buffer, st->sums);
+
+        for (j = 0; j < CP; ++j)
         {
-            for (j = 0; j < ACQUIRE_SYMBOLS; ++j)
-                st->sums[i] += st->buffer[i + j * FFTCP] * conjf(st->buffer[i + j * FFTCP + FFT]);
+            a += st->sums[j] * cpow(rot, j);
+            b += st->sums[j] * cpow(rot, -(double) j);
         }
 
         for (i = 0; i < FFTCP; ++i)
         {
             float mag;
-            float complex v = 0;
+            float complex v = (a - b) * (-0.25 * I);
 
-            for (j = 0; j < CP; ++j)
-                v += st->sums[(i + j) % FFTCP] * st->shape[j] * st->shape[j + FFT];
+            // slide by one lag; exp(i * theta * CP) = -1
+            a = (a - st->sums[i] - st->sums[(i + CP) % FFTCP]) * conj(rot);
+            b = (b - st->sums[i] - st->sums[(i + CP) % FFTCP]) * rot;
 
             mag = normf(v);
             if (mag > max_mag)
@@ -117,40 +262,38 @@ void acquire_process(acquire_t *st)
         input_set_sync_state(st->input, SYNC_STATE_COARSE);
     }
 
-    for (i = 0; i < FFTCP * (ACQUIRE_SYMBOLS + 1); i++)
-        st->buffer[i] = cq15_to_cf_conj(st->in_buffer[i]);
-
     sync_adjust(&st->input->sync, FFTCP / 2 - samperr);
     angle -= 2 * M_PI * st->cfo;
 
     st->phase *= cexpf(-(FFTCP / 2 - samperr) * angle / FFT * I);
 
-    phase_increment = cexpf(angle / FFT * I);
+    // mixer for one symbol, including the pulse shaping window and the
+    // conversion from Q15. Alternating signs shift the FFT output by half
+    // its length, which replaces fftshift.
+    for (i = 0; i < FFTCP; ++i)
+        st->nco[i] = ((i & 1) ? -1 : 1) * st->shape[i] / 32767.0f * cexpf(i * angle / FFT * I);
+    symbol_increment = cexpf(FFTCP * angle / FFT * I);
+
     for (i = 0; i < ACQUIRE_SYMBOLS; ++i)
     {
-        int j;
-        for (j = 0; j < FFTCP; ++j)
-        {
-            float complex sample = st->phase * st->buffer[i * FFTCP + j + samperr];
-            if (j < CP)
-                st->fftin[j] = st->shape[j] * sample;
-            else if (j < FFT)
-                st->fftin[j] = sample;
-            else
-                st->fftin[j - FFT] += st->shape[j] * sample;
-
-            st->phase *= phase_increment;
-        }
+        const cint16_t *x = &in[i * FFTCP + samperr];
+        float complex *y = st->fftin[i % BLKSZ];
+
+        mix(&x[0], &st->nco[0], st->phase, FFT, y, 0);
+        mix(&x[FFT], &st->nco[FFT], st->phase, CP, y, 1);
+
+        st->phase *= symbol_increment;
         st->phase /= cabsf(st->phase);
 
-        fftwf_execute(st->fft);
-        fftshift(st->fftout, FFT);
-        sync_push(&st->input->sync, st->fftout);
+        if (i % BLKSZ == BLKSZ - 1)
+        {
+            fftwf_execute(st->fft);
+            sync_push_block(&st->input->sync, st->fftin);
+        }
     }
 
-    keep = FFTCP + (FFTCP / 2 - samperr);
-    memmove(&st->in_buffer[0], &st->in_buffer[st->idx - keep], sizeof(cint16_t) * keep);
-    st->idx = keep;
+    // keep FFTCP + (FFTCP / 2 - samperr) samples
+    return ACQUIRE_LEN - FFTCP - (FFTCP / 2 - samperr);
 }
 
 void acquire_cfo_adjust(acquire_t *st, int cfo)
@@ -166,23 +309,9 @@ void acquire_cfo_adjust(acquire_t *st, int cfo)
     log_info("CFO: %f Hz", hz);
 }
 
-unsigned int acquire_push(acquire_t *st, cint16_t *buf, unsigned int length)
-{
-    unsigned int needed = FFTCP - st->idx % FFTCP;
-
-    if (length < needed)
-        return 0;
-
-    memcpy(&st->in_buffer[st->idx], buf, sizeof(cint16_t) * needed);
-    st->idx += needed;
-
-    return needed;
-}
-
 void acquire_reset(acquire_t *st)
 {
     firdecim_q15_reset(st->filter);
-    st->idx = 0;
     st->prev_angle = 0;
     st->phase = 1;
     st->cfo = 0;
@@ -190,11 +319,27 @@ void acquire_reset(acquire_t *st)
 
 void acquire_init(acquire_t *st, input_t *input)
 {
-    int i;
+    int i, fft_len = FFT;
 
     st->input = input;
+    st->corr = corr_generic;
+#if defined(HAVE_SSE2)
+    st->corr = corr_sse2;
+#elif defined(HAVE_NEON)
+    st->corr = corr_neon;
+#endif
+#ifdef HAVE_AVX2_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        st->corr = corr_avx2;
+#endif
     st->filter = firdecim_q15_create(filter_taps, sizeof(filter_taps) / sizeof(filter_taps[0]));
-    st->fft = fftwf_plan_dft_1d(FFT, st->fftin, st->fftout, FFTW_FORWARD, 0);
+
+    // one in-place transform per symbol in a block
+    fftw_planner_lock();
+    st->fft = fftwf_plan_many_dft(1, &fft_len, BLKSZ, st->fftin[0], NULL, 1, FFT,
+                                  st->fftin[0], NULL, 1, FFT, FFTW_FORWARD, 0);
+    fftw_planner_unlock();
 
     for (i = 0; i < FFTCP; ++i)
     {
@@ -213,5 +358,7 @@ void acquire_init(acquire_t *st, input_t *input)
 void acquire_free(acquire_t *st)
 {
     firdecim_q15_free(st->filter);
+    fftw_planner_lock();
     fftwf_destroy_plan(st->fft);
+    fftw_planner_unlock();
 }
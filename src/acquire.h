@@ -4,27 +4,31 @@
 #include <fftw3.h>
 #include "firdecim_q15.h"
 
+// samples needed by each call to acquire_process
+#define ACQUIRE_LEN (FFTCP * (ACQUIRE_SYMBOLS + 1))
+
+typedef void (*acquire_corr_t)(const float complex *buffer, float complex *sums);
+
 typedef struct
 {
     struct input_t *input;
+    acquire_corr_t corr;
     firdecim_q15 filter;
-    cint16_t in_buffer[FFTCP * (ACQUIRE_SYMBOLS + 1)];
-    float complex buffer[FFTCP * (ACQUIRE_SYMBOLS + 1)];
+    float complex buffer[ACQUIRE_LEN];
+    float complex nco[FFTCP];
     float complex sums[FFTCP];
-    float complex fftin[FFT];
-    float complex fftout[FFT];
+    float complex fftin[BLKSZ][FFT];
     float shape[FFTCP];
+    cint16_t filtered[FFTCP];
     fftwf_plan fft;
 
-    unsigned int idx;
     float prev_angle;
     float complex phase;
     int cfo;
 } acquire_t;
 
-void acquire_process(acquire_t *st);
+unsigned int acquire_process(acquire_t *st, const cint16_t *in);
 void acquire_cfo_adjust(acquire_t *st, int cfo);
-unsigned int acquire_push(acquire_t *st, cint16_t *buf, unsigned int length);
 void acquire_reset(acquire_t *st);
 void acquire_init(acquire_t *st, struct input_t *input);
 void acquire_free(acquire_t *st);
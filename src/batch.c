@@ -0,0 +1,563 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Batch decoding
+ *
+ * A recording is split into segments which are decoded in parallel, each by
+ * its own pipe-mode receiver. A receiver starts a few L1 frames before its
+ * segment, so that it has acquired the signal and filled the interleaver by
+ * the time the segment begins.
+ *
+ * Samples are piped one L1 block at a time, waiting for the P1 decoder after
+ * each block, and every event is stamped with the file offset reached when it
+ * was reported. Blocks are aligned to the start of the recording, so once
+ * synchronized, neighbouring receivers report the same events at the same
+ * offsets. A segment keeps the events stamped within its own range, which
+ * removes the duplicates from the overlap. Events are copied, then delivered
+ * on the calling thread in the order of the recording.
+ *
+ * The caller can stop decoding early through a cancel callback, which is
+ * polled between events and while waiting for a segment. Workers check for
+ * a stop after every L1 block.
+ */
+
+#include "config.h"
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "private.h"
+
+// bytes of 8-bit IQ samples per L1 block
+#define BATCH_BLOCK (FFTCP * BLKSZ * 2 * 2)
+// L1 blocks in a segment (32 L1 frames, about 48 seconds)
+#define BATCH_SEGMENT_BLOCKS (16 * 32)
+// L1 blocks decoded before a segment begins (3 L1 frames)
+#define BATCH_OVERLAP_BLOCKS (16 * 3)
+// segments decoded ahead of delivery, per thread
+#define BATCH_AHEAD 2
+// bytes per allocation for copied event data
+#define BATCH_ARENA_LEN (256 * 1024)
+// milliseconds between polls of the cancel callback while waiting
+#define BATCH_POLL_MS 100
+
+typedef struct arena_t
+{
+    struct arena_t *next;
+    size_t used;
+    size_t size;
+    max_align_t data[];
+} arena_t;
+
+typedef struct
+{
+    nrsc5_event_t *events;
+    unsigned int count;
+    unsigned int capacity;
+    arena_t *arena;
+    // an allocation failed, and events after it were dropped
+    int failed;
+    int done;
+} segment_t;
+
+typedef struct
+{
+    FILE *fp;
+    off_t base;
+    uint64_t length;
+#ifdef HAVE_MMAP
+    const uint8_t *map;
+    size_t map_len;
+#endif
+    pthread_mutex_t read_mutex;
+
+    segment_t *segments;
+    unsigned int count;
+    unsigned int next;
+    unsigned int delivered;
+    unsigned int ahead;
+    // set on cancellation or error, checked by workers after every block
+    atomic_int stop;
+    int error;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} batch_t;
+
+typedef struct
+{
+    segment_t *segment;
+    uint64_t start;
+    uint64_t pos;
+} recorder_t;
+
+static void *segment_alloc(segment_t *seg, size_t size)
+{
+    arena_t *a = seg->arena;
+    void *p;
+
+    size = (size + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1);
+    if (!a || a->used + size > a->size)
+    {
+        size_t len = size > BATCH_ARENA_LEN ? size : BATCH_ARENA_LEN;
+
+        a = malloc(sizeof(arena_t) + len);
+        if (!a)
+        {
+            seg->failed = 1;
+            return NULL;
+        }
+        a->used = 0;
+        a->size = len;
+        // keep filling the current block after a large allocation
+        if (seg->arena && size > BATCH_ARENA_LEN)
+        {
+            a->next = seg->arena->next;
+            seg->arena->next = a;
+        }
+        else
+        {
+            a->next = seg->arena;
+            seg->arena = a;
+        }
+    }
+
+    p = (uint8_t *) a->data + a->used;
+    a->used += size;
+    return p;
+}
+
+static void *segment_dup(segment_t *seg, const void *data, size_t size)
+{
+    void *p;
+
+    if (!data)
+        return NULL;
+    p = segment_alloc(seg, size);
+    if (p)
+        memcpy(p, data, size);
+    return p;
+}
+
+static const char *segment_strdup(segment_t *seg, const char *str)
+{
+    return str ? segment_dup(seg, str, strlen(str) + 1) : NULL;
+}
+
+static nrsc5_sig_service_t *copy_sig(segment_t *seg, const nrsc5_sig_service_t *services)
+{
+    nrsc5_sig_service_t *head = NULL, **sp = &head;
+
+    for (; services; services = services->next)
+    {
+        nrsc5_sig_service_t *s = segment_dup(seg, services, sizeof(*services));
+        nrsc5_sig_component_t **cp;
+
+        if (!s)
+            break;
+        s->name = segment_strdup(seg, services->name);
+        cp = &s->components;
+        for (const nrsc5_sig_component_t *c = services->components; c; c = c->next)
+        {
+            if (!(*cp = segment_dup(seg, c, sizeof(*c))))
+                break;
+            cp = &(*cp)->next;
+        }
+        *cp = NULL;
+
+        *sp = s;
+        sp = &s->next;
+    }
+    *sp = NULL;
+    return head;
+}
+
+static void record_event(const nrsc5_event_t *evt, void *opaque)
+{
+    recorder_t *rec = opaque;
+    segment_t *seg = rec->segment;
+    nrsc5_event_t *e;
+
+    // the IQ samples are already in the recording
+    if (evt->event == NRSC5_EVENT_IQ || evt->event == NRSC5_EVENT_LOST_DEVICE)
+        return;
+    // reported by the previous segment
+    if (rec->start > 0 && rec->pos <= rec->start)
+        return;
+    if (seg->failed)
+        return;
+
+    if (seg->count == seg->capacity)
+    {
+        unsigned int capacity = seg->capacity ? seg->capacity * 2 : 1024;
+        nrsc5_event_t *events = realloc(seg->events, capacity * sizeof(seg->events[0]));
+
+        if (!events)
+        {
+            seg->failed = 1;
+            return;
+        }
+        seg->events = events;
+        seg->capacity = capacity;
+    }
+    e = &seg->events[seg->count++];
+    *e = *evt;
+
+    switch (evt->event)
+    {
+    case NRSC5_EVENT_HDC:
+        e->hdc.data = segment_dup(seg, evt->hdc.data, evt->hdc.count);
+        break;
+    case NRSC5_EVENT_AUDIO:
+        e->audio.data = segment_dup(seg, evt->audio.data, evt->audio.count * sizeof(evt->audio.data[0]));
+        break;
+    case NRSC5_EVENT_ID3:
+        e->id3.title = segment_strdup(seg, evt->id3.title);
+        e->id3.artist = segment_strdup(seg, evt->id3.artist);
+        e->id3.album = segment_strdup(seg, evt->id3.album);
+        e->id3.genre = segment_strdup(seg, evt->id3.genre);
+        e->id3.ufid.owner = segment_strdup(seg, evt->id3.ufid.owner);
+        e->id3.ufid.id = segment_strdup(seg, evt->id3.ufid.id);
+        break;
+    case NRSC5_EVENT_SIG:
+        e->sig.services = copy_sig(seg, evt->sig.services);
+        break;
+    case NRSC5_EVENT_LOT:
+        e->lot.name = segment_strdup(seg, evt->lot.name);
+        e->lot.data = segment_dup(seg, evt->lot.data, evt->lot.size);
+        break;
+    case NRSC5_EVENT_SIS:
+    {
+        nrsc5_sis_asd_t **ap = &e->sis.audio_services;
+        nrsc5_sis_dsd_t **dp = &e->sis.data_services;
+
+        e->sis.country_code = segment_strdup(seg, evt->sis.country_code);
+        e->sis.name = segment_strdup(seg, evt->sis.name);
+        e->sis.slogan = segment_strdup(seg, evt->sis.slogan);
+        e->sis.message = segment_strdup(seg, evt->sis.message);
+        e->sis.alert = segment_strdup(seg, evt->sis.alert);
+        for (const nrsc5_sis_asd_t *a = evt->sis.audio_services; a; a = a->next)
+        {
+            if (!(*ap = segment_dup(seg, a, sizeof(*a))))
+                break;
+            ap = &(*ap)->next;
+        }
+        *ap = NULL;
+        for (const nrsc5_sis_dsd_t *d = evt->sis.data_services; d; d = d->next)
+        {
+            if (!(*dp = segment_dup(seg, d, sizeof(*d))))
+                break;
+            dp = &(*dp)->next;
+        }
+        *dp = NULL;
+        break;
+    }
+    }
+
+    // drop an event that could not be copied completely
+    if (seg->failed)
+        seg->count--;
+}
+
+static void segment_free(segment_t *seg)
+{
+    while (seg->arena)
+    {
+        arena_t *a = seg->arena;
+        seg->arena = a->next;
+        free(a);
+    }
+    free(seg->events);
+    seg->events = NULL;
+    seg->count = seg->capacity = 0;
+}
+
+static void batch_fail(batch_t *b)
+{
+    pthread_mutex_lock(&b->mutex);
+    b->error = 1;
+    atomic_store(&b->stop, 1);
+    pthread_cond_broadcast(&b->cond);
+    pthread_mutex_unlock(&b->mutex);
+}
+
+static void decode_segment(batch_t *b, unsigned int index, uint8_t *buf)
+{
+    uint64_t start = (uint64_t) index * BATCH_SEGMENT_BLOCKS * BATCH_BLOCK;
+    uint64_t end = start + (uint64_t) BATCH_SEGMENT_BLOCKS * BATCH_BLOCK;
+    uint64_t overlap = (uint64_t) BATCH_OVERLAP_BLOCKS * BATCH_BLOCK;
+    recorder_t rec;
+    nrsc5_t *radio;
+
+    if (end > b->length)
+        end = b->length;
+
+    rec.segment = &b->segments[index];
+    rec.start = start;
+
+    if (nrsc5_open_pipe(&radio) != 0)
+    {
+        log_error("Out of memory for receiver");
+        batch_fail(b);
+        return;
+    }
+    nrsc5_set_callback(radio, record_event, &rec);
+
+    for (rec.pos = start > overlap ? start - overlap : 0; rec.pos < end && !atomic_load(&b->stop); )
+    {
+        uint32_t len = end - rec.pos < BATCH_BLOCK ? end - rec.pos : BATCH_BLOCK;
+        const uint8_t *samples;
+
+#ifdef HAVE_MMAP
+        if (b->map)
+        {
+            samples = b->map + b->base + rec.pos;
+        }
+        else
+#endif
+        {
+            pthread_mutex_lock(&b->read_mutex);
+            if (fseeko(b->fp, b->base + rec.pos, SEEK_SET) != 0 || fread(buf, 1, len, b->fp) != len)
+            {
+                log_error("Read of IQ file failed");
+                pthread_mutex_unlock(&b->read_mutex);
+                batch_fail(b);
+                break;
+            }
+            pthread_mutex_unlock(&b->read_mutex);
+            samples = buf;
+        }
+
+        // events are stamped with the end of the block that caused them
+        rec.pos += len;
+        input_push_cu8(&radio->input, samples, len);
+        decode_wait(&radio->input.decode);
+
+        if (rec.segment->failed)
+        {
+            log_error("Out of memory for events");
+            batch_fail(b);
+        }
+    }
+
+    nrsc5_close(radio);
+}
+
+static void *batch_worker(void *arg)
+{
+    batch_t *b = arg;
+    uint8_t *buf = NULL;
+
+#ifdef HAVE_MMAP
+    if (!b->map)
+#endif
+    {
+        buf = malloc(BATCH_BLOCK);
+        if (!buf)
+        {
+            batch_fail(b);
+            return NULL;
+        }
+    }
+
+    pthread_mutex_lock(&b->mutex);
+    while (b->next < b->count && !atomic_load(&b->stop))
+    {
+        unsigned int index;
+
+        // limit the number of segments waiting to be delivered
+        if (b->next >= b->delivered + b->ahead)
+        {
+            pthread_cond_wait(&b->cond, &b->mutex);
+            continue;
+        }
+
+        index = b->next++;
+        pthread_mutex_unlock(&b->mutex);
+
+        decode_segment(b, index, buf);
+
+        pthread_mutex_lock(&b->mutex);
+        b->segments[index].done = 1;
+        pthread_cond_broadcast(&b->cond);
+    }
+    pthread_mutex_unlock(&b->mutex);
+
+    free(buf);
+    return NULL;
+}
+
+// wait for a segment, polling the cancel callback; returns non-zero to stop
+static int wait_segment(batch_t *b, segment_t *seg, nrsc5_cancel_t cancel, void *opaque)
+{
+    int stop;
+
+    pthread_mutex_lock(&b->mutex);
+    while (!seg->done && !atomic_load(&b->stop))
+    {
+        struct timespec ts;
+
+        if (!cancel)
+        {
+            pthread_cond_wait(&b->cond, &b->mutex);
+            continue;
+        }
+
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += BATCH_POLL_MS * 1000000;
+        if (ts.tv_nsec >= 1000000000)
+        {
+            ts.tv_nsec -= 1000000000;
+            ts.tv_sec += 1;
+        }
+        pthread_cond_timedwait(&b->cond, &b->mutex, &ts);
+
+        pthread_mutex_unlock(&b->mutex);
+        if (cancel(opaque))
+            atomic_store(&b->stop, 1);
+        pthread_mutex_lock(&b->mutex);
+    }
+    stop = atomic_load(&b->stop);
+    pthread_mutex_unlock(&b->mutex);
+
+    return stop;
+}
+
+static void batch_stop(batch_t *b)
+{
+    pthread_mutex_lock(&b->mutex);
+    atomic_store(&b->stop, 1);
+    pthread_cond_broadcast(&b->cond);
+    pthread_mutex_unlock(&b->mutex);
+}
+
+NRSC5_API int nrsc5_decode_file(FILE *fp, unsigned int threads, nrsc5_callback_t callback, void *opaque, nrsc5_cancel_t cancel)
+{
+    struct timespec begin, now;
+    pthread_t *workers;
+    batch_t b = { 0 };
+    unsigned int started = 0;
+    off_t end;
+    double elapsed;
+
+    if (threads == 0)
+        return 1;
+
+    b.fp = fp;
+    b.base = ftello(fp);
+    if (b.base < 0 || fseeko(fp, 0, SEEK_END) != 0 || (end = ftello(fp)) < b.base)
+        return 1;
+    b.length = (end - b.base) & ~(uint64_t) 3;
+    if (b.length == 0)
+        return 1;
+
+#ifdef HAVE_MMAP
+    {
+        struct stat sb;
+
+        if (fstat(fileno(fp), &sb) == 0 && S_ISREG(sb.st_mode) && (uint64_t) end <= SIZE_MAX)
+        {
+            void *map = mmap(NULL, end, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+            if (map != MAP_FAILED)
+            {
+                b.map = map;
+                b.map_len = end;
+            }
+        }
+    }
+#endif
+
+    b.count = (b.length + (uint64_t) BATCH_SEGMENT_BLOCKS * BATCH_BLOCK - 1) / ((uint64_t) BATCH_SEGMENT_BLOCKS * BATCH_BLOCK);
+    if (threads > b.count)
+        threads = b.count;
+    b.segments = calloc(b.count, sizeof(segment_t));
+    workers = malloc(threads * sizeof(pthread_t));
+    if (!b.segments || !workers)
+    {
+        b.error = 1;
+        goto done;
+    }
+    b.ahead = threads * BATCH_AHEAD;
+    atomic_init(&b.stop, 0);
+    pthread_mutex_init(&b.read_mutex, NULL);
+    pthread_mutex_init(&b.mutex, NULL);
+    pthread_cond_init(&b.cond, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    for (; started < threads; started++)
+    {
+        if (pthread_create(&workers[started], NULL, batch_worker, &b) != 0)
+            break;
+    }
+    if (started == 0)
+        b.error = 1;
+
+    for (unsigned int i = 0; i < b.count && started > 0; i++)
+    {
+        segment_t *seg = &b.segments[i];
+
+        if (wait_segment(&b, seg, cancel, opaque))
+            break;
+
+        for (unsigned int j = 0; j < seg->count; j++)
+        {
+            if (cancel && cancel(opaque))
+                break;
+            callback(&seg->events[j], opaque);
+        }
+        segment_free(seg);
+
+        pthread_mutex_lock(&b.mutex);
+        b.delivered++;
+        pthread_cond_broadcast(&b.cond);
+        pthread_mutex_unlock(&b.mutex);
+
+        if (cancel && cancel(opaque))
+            break;
+    }
+
+    // workers stop after their current block
+    batch_stop(&b);
+    for (unsigned int i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+    for (unsigned int i = 0; i < b.count; i++)
+        segment_free(&b.segments[i]);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - begin.tv_sec) + (now.tv_nsec - begin.tv_nsec) / 1e9;
+    if (elapsed > 0 && b.delivered == b.count)
+        log_info("Processed %.1f s of samples in %.1f s (%.1fx real time)",
+                 b.length / (2.0 * SAMPLE_RATE), elapsed, b.length / (2.0 * SAMPLE_RATE) / elapsed);
+
+    pthread_cond_destroy(&b.cond);
+    pthread_mutex_destroy(&b.mutex);
+    pthread_mutex_destroy(&b.read_mutex);
+
+done:
+#ifdef HAVE_MMAP
+    if (b.map)
+        munmap((void *) b.map, b.map_len);
+#endif
+    free(workers);
+    free(b.segments);
+    return b.error;
+}
@@ -0,0 +1,288 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Wideband input
+ *
+ * Splits a wideband capture into one channel per station. Each station has
+ * its own resampler and pipe-mode receiver, and runs on its own thread.
+ * Every block of input samples is converted once and then processed by all
+ * stations in parallel.
+ */
+
+#include <string.h>
+
+#include "private.h"
+#include "resamp.h"
+
+typedef struct
+{
+    nrsc5_channelizer_t *parent;
+    nrsc5_t *radio;
+    resamp resamp;
+    cint16_t *out;
+    unsigned int out_len;
+    unsigned int generation;
+    pthread_t thread;
+} channel_t;
+
+struct nrsc5_channelizer_t
+{
+    unsigned int sample_rate;
+    float center_freq;
+
+    channel_t **channels;
+    unsigned int num_channels;
+
+    float complex *samples;
+    unsigned int samples_len;
+    unsigned int count;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    unsigned int generation;
+    unsigned int pending;
+    // a station could not process the current block
+    int failed;
+    int closed;
+};
+
+static void *channel_thread(void *arg)
+{
+    channel_t *ch = arg;
+    nrsc5_channelizer_t *st = ch->parent;
+
+    pthread_mutex_lock(&st->mutex);
+    while (1)
+    {
+        while (!st->closed && ch->generation == st->generation)
+            pthread_cond_wait(&st->cond, &st->mutex);
+        if (st->closed)
+            break;
+        ch->generation = st->generation;
+        pthread_mutex_unlock(&st->mutex);
+
+        int failed = 0;
+        unsigned int max = resamp_max_output(ch->resamp, st->count);
+        if (max > ch->out_len)
+        {
+            cint16_t *out = realloc(ch->out, sizeof(cint16_t) * max);
+            if (out)
+            {
+                ch->out = out;
+                ch->out_len = max;
+            }
+            else
+            {
+                log_error("Out of memory for station at %.1f MHz", ch->radio->freq / 1e6);
+                failed = 1;
+            }
+        }
+
+        if (!failed)
+        {
+            unsigned int n = resamp_execute(ch->resamp, st->samples, st->count, ch->out);
+            failed = nrsc5_pipe_samples_cs16(ch->radio, (int16_t *) ch->out, n * 2);
+        }
+
+        pthread_mutex_lock(&st->mutex);
+        if (failed)
+            st->failed = 1;
+        if (--st->pending == 0)
+            pthread_cond_broadcast(&st->cond);
+    }
+    pthread_mutex_unlock(&st->mutex);
+
+    return NULL;
+}
+
+NRSC5_API int nrsc5_channelizer_open(nrsc5_channelizer_t **result, unsigned int sample_rate, float center_freq)
+{
+    nrsc5_channelizer_t *st;
+
+    // the demodulator needs at least its own bandwidth
+    if (sample_rate < SAMPLE_RATE / 2)
+    {
+        *result = NULL;
+        return 1;
+    }
+
+    st = calloc(1, sizeof(*st));
+    if (!st)
+    {
+        *result = NULL;
+        return 1;
+    }
+    st->sample_rate = sample_rate;
+    st->center_freq = center_freq;
+    pthread_mutex_init(&st->mutex, NULL);
+    pthread_cond_init(&st->cond, NULL);
+
+    *result = st;
+    return 0;
+}
+
+NRSC5_API int nrsc5_channelizer_add_station(nrsc5_channelizer_t *st, float freq, nrsc5_t **radio)
+{
+    float offset = freq - st->center_freq;
+    channel_t **channels;
+    channel_t *ch;
+
+    // The resampler passes 300 kHz either side of the station, and its
+    // transition band ends near SAMPLE_RATE / 4. Require all of that to lie
+    // within the capture, so that nothing beyond the band edge aliases in.
+    if (fabsf(offset) + SAMPLE_RATE / 4 > st->sample_rate / 2)
+    {
+        log_error("Station at %.1f MHz is outside of the captured band", freq / 1e6);
+        *radio = NULL;
+        return 1;
+    }
+
+    ch = calloc(1, sizeof(*ch));
+    if (!ch)
+    {
+        *radio = NULL;
+        return 1;
+    }
+    ch->parent = st;
+    ch->resamp = resamp_create(st->sample_rate, offset);
+    if (!ch->resamp)
+    {
+        free(ch);
+        *radio = NULL;
+        return 1;
+    }
+    if (nrsc5_open_pipe(&ch->radio) != 0)
+    {
+        resamp_free(ch->resamp);
+        free(ch);
+        *radio = NULL;
+        return 1;
+    }
+    ch->radio->freq = freq;
+
+    // wait for any block in progress before adding the station
+    pthread_mutex_lock(&st->mutex);
+    while (st->pending > 0)
+        pthread_cond_wait(&st->cond, &st->mutex);
+
+    channels = realloc(st->channels, sizeof(channel_t *) * (st->num_channels + 1));
+    if (!channels)
+    {
+        pthread_mutex_unlock(&st->mutex);
+        nrsc5_close(ch->radio);
+        resamp_free(ch->resamp);
+        free(ch);
+        *radio = NULL;
+        return 1;
+    }
+    st->channels = channels;
+
+    ch->generation = st->generation;
+    st->channels[st->num_channels++] = ch;
+    pthread_create(&ch->thread, NULL, channel_thread, ch);
+    pthread_mutex_unlock(&st->mutex);
+
+    *radio = ch->radio;
+    return 0;
+}
+
+static int channelizer_push(nrsc5_channelizer_t *st)
+{
+    int failed;
+
+    pthread_mutex_lock(&st->mutex);
+    st->failed = 0;
+    if (st->num_channels > 0)
+    {
+        st->generation++;
+        st->pending = st->num_channels;
+        pthread_cond_broadcast(&st->cond);
+
+        while (st->pending > 0)
+            pthread_cond_wait(&st->cond, &st->mutex);
+    }
+    failed = st->failed;
+    pthread_mutex_unlock(&st->mutex);
+
+    return failed;
+}
+
+static int channelizer_reserve(nrsc5_channelizer_t *st, unsigned int count)
+{
+    if (count > st->samples_len)
+    {
+        float complex *samples = realloc(st->samples, sizeof(float complex) * count);
+        if (!samples)
+            return 1;
+        st->samples = samples;
+        st->samples_len = count;
+    }
+    st->count = count;
+    return 0;
+}
+
+NRSC5_API int nrsc5_channelizer_pipe_samples_cs16(nrsc5_channelizer_t *st, int16_t *samples, unsigned int length)
+{
+    if (length % 2 != 0)
+        return 1;
+
+    if (channelizer_reserve(st, length / 2) != 0)
+        return 1;
+    for (unsigned int i = 0; i < length / 2; i++)
+        st->samples[i] = CMPLXF(samples[i * 2] / 32768.0f, samples[i * 2 + 1] / 32768.0f);
+
+    return channelizer_push(st);
+}
+
+NRSC5_API int nrsc5_channelizer_pipe_samples_cf32(nrsc5_channelizer_t *st, float *samples, unsigned int length)
+{
+    if (length % 2 != 0)
+        return 1;
+
+    if (channelizer_reserve(st, length / 2) != 0)
+        return 1;
+    memcpy(st->samples, samples, sizeof(float) * length);
+
+    return channelizer_push(st);
+}
+
+NRSC5_API void nrsc5_channelizer_close(nrsc5_channelizer_t *st)
+{
+    if (!st)
+        return;
+
+    pthread_mutex_lock(&st->mutex);
+    st->closed = 1;
+    pthread_cond_broadcast(&st->cond);
+    pthread_mutex_unlock(&st->mutex);
+
+    for (unsigned int i = 0; i < st->num_channels; i++)
+    {
+        channel_t *ch = st->channels[i];
+
+        pthread_join(ch->thread, NULL);
+        nrsc5_close(ch->radio);
+        resamp_free(ch->resamp);
+        free(ch->out);
+        free(ch);
+    }
+
+    pthread_mutex_destroy(&st->mutex);
+    pthread_cond_destroy(&st->cond);
+    free(st->channels);
+    free(st->samples);
+    free(st);
+}
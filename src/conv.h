@@ -15,7 +15,9 @@ enum {
  * k    - Constraint length (5 or 7)
  * rgen - Recursive generator polynomial in octal
  * gen  - Generator polynomials in octal
- * punc - Puncturing matrix (-1 terminated)
+ * punc - Periodic puncturing pattern, 1 for transmitted and 0 for punctured
+ *        bits, spanning a whole number of trellis steps (-1 terminated, or
+ *        NULL for no puncturing)
  * term - Termination type (zero flush default)
  */
 struct lte_conv_code {
@@ -24,12 +26,18 @@ struct lte_conv_code {
 	int len;
 	unsigned rgen;
 	unsigned gen[4];
-	int *punc;
+	const int *punc;
 	int term;
 };
 
-int nrsc5_conv_decode_p1(const int8_t *in, uint8_t *out);
-int nrsc5_conv_decode_pids(const int8_t *in, uint8_t *out);
-int nrsc5_conv_decode_p3(const int8_t *in, uint8_t *out);
+struct vdecoder;
+
+struct vdecoder *nrsc5_conv_alloc(int len, int depth, const int *punc);
+void nrsc5_conv_free(struct vdecoder *dec);
+/*
+ * Decode 'len' bits into 'out', packed eight to a byte with the first bit of
+ * each byte in the least significant position.
+ */
+int nrsc5_conv_decode(struct vdecoder *dec, const int8_t *in, uint8_t *out);
 
 #endif /* _CONV_H_ */
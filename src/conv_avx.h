@@ -0,0 +1,229 @@
+/*
+ * Viterbi decoder for convolutional codes - Intel AVX2/AVX-512
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <immintrin.h>
+
+/*
+ * These kernels are compiled with function level target attributes and
+ * selected at runtime, so they are available regardless of the compiler
+ * flags used for the rest of the library.
+ *
+ * Unlike the SSE kernel, the trellis outputs are expected in transposed
+ * form: 32 outputs of the first generator polynomial, followed by 32 of
+ * the second and 32 of the third. The arithmetic (saturating adds, signed
+ * compare and signed minimum normalization) matches the SSE kernel, so
+ * all kernels produce identical path metrics and decisions.
+ */
+
+#ifdef HAVE_AVX2_DISPATCH
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+/*
+ * 16-wide butterfly
+ *
+ * Input:
+ * M0 - Path metrics of even states
+ * M1 - Path metrics of odd states
+ * M2 - Branch metrics
+ *
+ * Output:
+ * M3 - Selected and accumulated path metrics 0
+ * M4 - Selected and accumulated path metrics 1
+ * D0 - Path selections 0
+ * D1 - Path selections 1
+ */
+#define AVX2_BUTTERFLY(M0,M1,M2,M3,M4,D0,D1) \
+{ \
+	__m256i _a = _mm256_adds_epi16(M0, M2); \
+	__m256i _b = _mm256_subs_epi16(M1, M2); \
+	__m256i _c = _mm256_subs_epi16(M0, M2); \
+	__m256i _d = _mm256_adds_epi16(M1, M2); \
+	M3 = _mm256_max_epi16(_a, _b); \
+	D0 = _mm256_cmpgt_epi16(_a, _b); \
+	M4 = _mm256_max_epi16(_c, _d); \
+	D1 = _mm256_cmpgt_epi16(_c, _d); \
+}
+
+/*
+ * Deinterleave 32 path metrics into even and odd states
+ *
+ * Shuffle even elements to the low and odd elements to the high half of
+ * each 128-bit lane, gather the halves with a 64-bit permute and combine
+ * the two registers across lanes.
+ */
+#define AVX2_DEINTERLEAVE(M0,M1,E,O) \
+{ \
+	const __m256i _mask = _mm256_set_epi8(15, 14, 11, 10, 7, 6, 3, 2, \
+					      13, 12, 9, 8, 5, 4, 1, 0, \
+					      15, 14, 11, 10, 7, 6, 3, 2, \
+					      13, 12, 9, 8, 5, 4, 1, 0); \
+	M0 = _mm256_shuffle_epi8(M0, _mask); \
+	M1 = _mm256_shuffle_epi8(M1, _mask); \
+	M0 = _mm256_permute4x64_epi64(M0, _MM_SHUFFLE(3, 1, 2, 0)); \
+	M1 = _mm256_permute4x64_epi64(M1, _MM_SHUFFLE(3, 1, 2, 0)); \
+	E = _mm256_permute2x128_si256(M0, M1, 0x20); \
+	O = _mm256_permute2x128_si256(M0, M1, 0x31); \
+}
+
+/* Pack 32 path selections (16-bit, 0 or -1) into decision bits */
+AVX2_TARGET
+static inline uint64_t _avx2_pack_paths(__m256i d0, __m256i d1)
+{
+	__m256i p = _mm256_packs_epi16(d0, d1);
+
+	p = _mm256_permute4x64_epi64(p, _MM_SHUFFLE(3, 1, 2, 0));
+	return (uint32_t) _mm256_movemask_epi8(p);
+}
+
+/* Signed horizontal minimum of 16 packed 16-bit integers */
+AVX2_TARGET
+static inline __m256i _avx2_minpos(__m256i m)
+{
+	__m128i t = _mm_min_epi16(_mm256_castsi256_si128(m),
+				  _mm256_extracti128_si256(m, 1));
+
+	t = _mm_min_epi16(t, _mm_shuffle_epi32(t, _MM_SHUFFLE(0, 0, 3, 2)));
+	t = _mm_min_epi16(t, _mm_shufflelo_epi16(t, _MM_SHUFFLE(0, 0, 3, 2)));
+	t = _mm_min_epi16(t, _mm_shufflelo_epi16(t, _MM_SHUFFLE(0, 0, 0, 1)));
+	return _mm256_broadcastw_epi16(t);
+}
+
+AVX2_TARGET
+static void avx2_metrics_k7_n3(const int8_t *val, const int16_t *out,
+			       int16_t *sums, uint64_t *paths, int norm)
+{
+	__m256i s0, s1, s2, s3, e0, o0, e1, o1, m0, m1;
+	__m256i n0, n1, n2, n3, d0, d1, d2, d3, v;
+
+	/* (PMU) Load and deinterleave accumulated path metrics */
+	s0 = _mm256_loadu_si256((__m256i *) &sums[0]);
+	s1 = _mm256_loadu_si256((__m256i *) &sums[16]);
+	s2 = _mm256_loadu_si256((__m256i *) &sums[32]);
+	s3 = _mm256_loadu_si256((__m256i *) &sums[48]);
+
+	AVX2_DEINTERLEAVE(s0, s1, e0, o0)
+	AVX2_DEINTERLEAVE(s2, s3, e1, o1)
+
+	/* (BMU) Branch metrics for butterflies 0-15 and 16-31 */
+	v = _mm256_set1_epi16(val[0]);
+	m0 = _mm256_sign_epi16(v, _mm256_loadu_si256((__m256i *) &out[0]));
+	m1 = _mm256_sign_epi16(v, _mm256_loadu_si256((__m256i *) &out[16]));
+	v = _mm256_set1_epi16(val[1]);
+	m0 = _mm256_adds_epi16(m0, _mm256_sign_epi16(v, _mm256_loadu_si256((__m256i *) &out[32])));
+	m1 = _mm256_adds_epi16(m1, _mm256_sign_epi16(v, _mm256_loadu_si256((__m256i *) &out[48])));
+	v = _mm256_set1_epi16(val[2]);
+	m0 = _mm256_adds_epi16(m0, _mm256_sign_epi16(v, _mm256_loadu_si256((__m256i *) &out[64])));
+	m1 = _mm256_adds_epi16(m1, _mm256_sign_epi16(v, _mm256_loadu_si256((__m256i *) &out[80])));
+
+	/* (PMU) Butterflies: 0-15 and 16-31 */
+	AVX2_BUTTERFLY(e0, o0, m0, n0, n2, d0, d2)
+	AVX2_BUTTERFLY(e1, o1, m1, n1, n3, d1, d3)
+
+	*paths = _avx2_pack_paths(d0, d1) | (_avx2_pack_paths(d2, d3) << 32);
+
+	if (norm) {
+		v = _avx2_minpos(_mm256_min_epi16(_mm256_min_epi16(n0, n1),
+						  _mm256_min_epi16(n2, n3)));
+		n0 = _mm256_subs_epi16(n0, v);
+		n1 = _mm256_subs_epi16(n1, v);
+		n2 = _mm256_subs_epi16(n2, v);
+		n3 = _mm256_subs_epi16(n3, v);
+	}
+
+	_mm256_storeu_si256((__m256i *) &sums[0], n0);
+	_mm256_storeu_si256((__m256i *) &sums[16], n1);
+	_mm256_storeu_si256((__m256i *) &sums[32], n2);
+	_mm256_storeu_si256((__m256i *) &sums[48], n3);
+}
+
+#endif /* HAVE_AVX2_DISPATCH */
+
+#ifdef HAVE_AVX512_DISPATCH
+
+#define AVX512_TARGET __attribute__((target("avx512f,avx512bw")))
+
+/* Permutation indices selecting even and odd states from two registers */
+static const int16_t avx512_even_idx[32] = {
+	 0,  2,  4,  6,  8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30,
+	32, 34, 36, 38, 40, 42, 44, 46, 48, 50, 52, 54, 56, 58, 60, 62,
+};
+static const int16_t avx512_odd_idx[32] = {
+	 1,  3,  5,  7,  9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31,
+	33, 35, 37, 39, 41, 43, 45, 47, 49, 51, 53, 55, 57, 59, 61, 63,
+};
+
+AVX512_TARGET
+static void avx512_metrics_k7_n3(const int8_t *val, const int16_t *out,
+				 int16_t *sums, uint64_t *paths, int norm)
+{
+	__m512i s0, s1, e, o, m, a, b, c, d, n0, n1;
+	__m256i t;
+	__m128i u;
+	__mmask32 d0, d1;
+
+	const __m512i even = _mm512_loadu_si512((void *) avx512_even_idx);
+	const __m512i odd = _mm512_loadu_si512((void *) avx512_odd_idx);
+
+	/* (PMU) Load and deinterleave accumulated path metrics */
+	s0 = _mm512_loadu_si512((void *) &sums[0]);
+	s1 = _mm512_loadu_si512((void *) &sums[32]);
+	e = _mm512_permutex2var_epi16(s0, even, s1);
+	o = _mm512_permutex2var_epi16(s0, odd, s1);
+
+	/* (BMU) Branch metrics for butterflies 0-31 */
+	m = _mm512_mullo_epi16(_mm512_set1_epi16(val[0]),
+			       _mm512_loadu_si512((void *) &out[0]));
+	m = _mm512_adds_epi16(m, _mm512_mullo_epi16(_mm512_set1_epi16(val[1]),
+			      _mm512_loadu_si512((void *) &out[32])));
+	m = _mm512_adds_epi16(m, _mm512_mullo_epi16(_mm512_set1_epi16(val[2]),
+			      _mm512_loadu_si512((void *) &out[64])));
+
+	/* (PMU) Butterflies: 0-31 */
+	a = _mm512_adds_epi16(e, m);
+	b = _mm512_subs_epi16(o, m);
+	c = _mm512_subs_epi16(e, m);
+	d = _mm512_adds_epi16(o, m);
+	n0 = _mm512_max_epi16(a, b);
+	n1 = _mm512_max_epi16(c, d);
+	d0 = _mm512_cmpgt_epi16_mask(a, b);
+	d1 = _mm512_cmpgt_epi16_mask(c, d);
+
+	*paths = (uint64_t) d0 | ((uint64_t) d1 << 32);
+
+	if (norm) {
+		m = _mm512_min_epi16(n0, n1);
+		t = _mm256_min_epi16(_mm512_castsi512_si256(m),
+				     _mm512_extracti64x4_epi64(m, 1));
+		u = _mm_min_epi16(_mm256_castsi256_si128(t),
+				  _mm256_extracti128_si256(t, 1));
+		u = _mm_min_epi16(u, _mm_shuffle_epi32(u, _MM_SHUFFLE(0, 0, 3, 2)));
+		u = _mm_min_epi16(u, _mm_shufflelo_epi16(u, _MM_SHUFFLE(0, 0, 3, 2)));
+		u = _mm_min_epi16(u, _mm_shufflelo_epi16(u, _MM_SHUFFLE(0, 0, 0, 1)));
+		m = _mm512_broadcastw_epi16(u);
+		n0 = _mm512_subs_epi16(n0, m);
+		n1 = _mm512_subs_epi16(n1, m);
+	}
+
+	_mm512_storeu_si512((void *) &sums[0], n0);
+	_mm512_storeu_si512((void *) &sums[32], n1);
+}
+
+#endif /* HAVE_AVX512_DISPATCH */
@@ -28,6 +28,7 @@
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "defines.h"
 #include "conv.h"
@@ -40,6 +41,10 @@
 #include "conv_gen.h"
 #endif
 
+#if defined(HAVE_AVX2_DISPATCH) || defined(HAVE_AVX512_DISPATCH)
+#include "conv_avx.h"
+#endif
+
 #define PARITY(X) __builtin_parity(X)
 #define TAIL_BITING_EXTRA 32
 
@@ -57,18 +62,39 @@ struct vstate {
 /*
  * Trellis Object
  *
+ * The trellis only depends on the code, so a single read-only instance is
+ * shared by all decoders.
+ *
  * num_states - Number of states in the trellis
- * sums       - Accumulated path metrics
  * outputs    - Trellis ouput values
+ * outputs_t  - Trellis output values transposed by generator polynomial
  * vals       - Input value that led to each state
  */
 struct vtrellis {
 	int num_states;
-	int16_t *sums;
 	int16_t *outputs;
+	int16_t *outputs_t;
 	uint8_t *vals;
 };
 
+typedef void (*metric_func_t)(const int8_t *, const int16_t *,
+			      int16_t *, uint64_t *, int);
+
+/*
+ * Puncturing pattern for one trellis step
+ *
+ * pos  - Offset of the first transmitted bit of the step within a period
+ * kept - Number of transmitted bits in the step
+ * off  - Offset of each output bit from the first transmitted bit
+ * mask - 0 for punctured output bits, which are read as zero
+ */
+struct punc_step {
+	int pos;
+	int kept;
+	int off[3];
+	int8_t mask[3];
+};
+
 /*
  * Viterbi Decoder
  *
@@ -77,9 +103,19 @@ struct vtrellis {
  * len       - Horizontal length of trellis
  * recursive - Set to '1' if the code is recursive
  * intrvl    - Normalization interval
- * trellis   - Trellis object
- * punc      - Puncturing sequence
- * paths     - Trellis paths
+ * code_len  - Length of the code (bits per frame)
+ * term      - Termination type
+ * depth     - Traceback depth for windowed decoding (0 for full traceback)
+ * rows      - Number of trellis steps held in the path buffer
+ * trellis   - Shared trellis object
+ * sums      - Accumulated path metrics
+ * punc      - Puncturing pattern
+ * punc_steps - Trellis steps covered by one period of the pattern
+ * punc_kept  - Transmitted bits per period of the pattern
+ * punc_tab   - Gather offsets for each step in a period
+ * paths     - Trellis paths, one packed decision word per step
+ * metric_func - Combined branch and path metric kernel
+ * metric_out  - Trellis outputs in the layout expected by the kernel
  */
 struct vdecoder {
 	int n;
@@ -87,20 +123,28 @@ struct vdecoder {
 	int len;
 	int recursive;
 	int intrvl;
-	struct vtrellis *trellis;
-	int *punc;
-	int16_t **paths;
-
-	void (*metric_func)(const int8_t *, const int16_t *,
-			    int16_t *, int16_t *, int);
+	int code_len;
+	int term;
+	int depth;
+	int rows;
+	const struct vtrellis *trellis;
+	int16_t *sums;
+	const int *punc;
+	int punc_steps;
+	int punc_kept;
+	struct punc_step *punc_tab;
+	uint64_t *paths;
+
+	metric_func_t metric_func;
+	const int16_t *metric_out;
 };
 
 /*
  * Aligned Memory Allocator
  *
  * SSE requires 16-byte memory alignment. We store relevant trellis values
- * (accumulated sums, outputs, and path decisions) as 16 bit signed integers
- * so the allocated memory is casted as such.
+ * (accumulated sums and outputs) as 16 bit signed integers so the allocated
+ * memory is casted as such. Path decisions are bit-packed separately.
  */
 #define SSE_ALIGN	16
 
@@ -113,6 +157,23 @@ static int16_t *vdec_malloc(size_t n)
 #endif
 }
 
+/*
+ * Path decision lookup
+ *
+ * Decisions for all states of a trellis step are packed into one 64-bit
+ * word. A set bit corresponds to the -1 path selection of the unpacked
+ * representation, so the traceback path value is the inverted bit.
+ */
+static inline uint64_t *vdec_paths(struct vdecoder *dec, int i)
+{
+	return &dec->paths[i % dec->rows];
+}
+
+static inline unsigned vdec_path(struct vdecoder *dec, int i, unsigned state)
+{
+	return ((*vdec_paths(dec, i) >> state) & 1) ^ 1;
+}
+
 /* Left shift and mask for finding the previous state */
 static unsigned vstate_lshift(unsigned reg, int k, int val)
 {
@@ -197,7 +258,7 @@ static void free_trellis(struct vtrellis *trellis)
 
 	free(trellis->vals);
 	free(trellis->outputs);
-	free(trellis->sums);
+	free(trellis->outputs_t);
 	free(trellis);
 }
 
@@ -213,7 +274,7 @@ static void free_trellis(struct vtrellis *trellis)
  */
 static struct vtrellis *generate_trellis(const struct lte_conv_code *code)
 {
-	int i;
+	int i, j;
 	struct vtrellis *trellis;
 	int16_t *out;
 
@@ -221,12 +282,15 @@ static struct vtrellis *generate_trellis(const struct lte_conv_code *code)
 	int olen = (code->n == 2) ? 2 : 4;
 
 	trellis = (struct vtrellis *) calloc(1, sizeof(struct vtrellis));
+	if (!trellis)
+		return NULL;
+
 	trellis->num_states = ns;
-	trellis->sums =	vdec_malloc(ns);
 	trellis->outputs = vdec_malloc(ns * olen);
+	trellis->outputs_t = vdec_malloc(ns / 2 * code->n);
 	trellis->vals = (uint8_t *) malloc(ns * sizeof(uint8_t));
 
-	if (!trellis->sums || !trellis->outputs)
+	if (!trellis->outputs || !trellis->outputs_t || !trellis->vals)
 		goto fail;
 
 	/* Populate the trellis state objects */
@@ -239,12 +303,56 @@ static struct vtrellis *generate_trellis(const struct lte_conv_code *code)
 			gen_state_info(code, &trellis->vals[i], i, out);
 	}
 
+	/* Outputs used by the butterflies, grouped by generator polynomial */
+	for (i = 0; i < ns / 2; i++) {
+		for (j = 0; j < code->n; j++)
+			trellis->outputs_t[j * ns / 2 + i] = trellis->outputs[olen * i + j];
+	}
+
 	return trellis;
 fail:
 	free_trellis(trellis);
 	return NULL;
 }
 
+/* NRSC-5 rate 1/3, K = 7 mother code used by all logical channels */
+static const struct lte_conv_code nrsc5_code = {
+	.n = 3,
+	.k = 7,
+	.gen = { 0133, 0171, 0165 },
+	.term = CONV_TERM_TAIL_BITING,
+};
+
+static struct vtrellis *shared_trellis;
+static metric_func_t shared_metric_func;
+static pthread_once_t shared_trellis_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Select the metric kernel
+ *
+ * Prefer the widest vector extension supported by the running CPU. The
+ * compile time kernel (SSE, NEON or generic) is used otherwise.
+ */
+static void init_shared_trellis(void)
+{
+	shared_trellis = generate_trellis(&nrsc5_code);
+	shared_metric_func = gen_metrics_k7_n3;
+
+#if defined(HAVE_AVX2_DISPATCH) || defined(HAVE_AVX512_DISPATCH)
+	__builtin_cpu_init();
+#endif
+#ifdef HAVE_AVX512_DISPATCH
+	if (__builtin_cpu_supports("avx512bw")) {
+		shared_metric_func = avx512_metrics_k7_n3;
+		return;
+	}
+#endif
+#ifdef HAVE_AVX2_DISPATCH
+	if (__builtin_cpu_supports("avx2"))
+		shared_metric_func = avx2_metrics_k7_n3;
+#endif
+}
+
 /*
  * Reset decoder
  *
@@ -257,78 +365,151 @@ static void reset_decoder(struct vdecoder *dec, int term)
 {
 	int ns = dec->trellis->num_states;
 
-	memset(dec->trellis->sums, 0, sizeof(int16_t) * ns);
+	memset(dec->sums, 0, sizeof(int16_t) * ns);
 
 	if (term != CONV_TERM_TAIL_BITING)
-		dec->trellis->sums[0] = INT8_MAX * dec->n * dec->k;
+		dec->sums[0] = INT8_MAX * dec->n * dec->k;
+}
+
+/* Follow the survivor path from step 'from' back to step 'to' (inclusive) */
+static unsigned _traceback_skip(struct vdecoder *dec,
+				unsigned state, int from, int to)
+{
+	int i;
+	unsigned path;
+
+	for (i = from; i >= to; i--) {
+		path = vdec_path(dec, i, state);
+		state = vstate_lshift(state, dec->k, path);
+	}
+
+	return state;
+}
+
+/* Store decoded bit 'i', packed LSB first */
+static inline void put_bit(uint8_t *out, int i, unsigned bit)
+{
+	uint8_t mask = 1 << (i & 7);
+
+	out[i >> 3] = (out[i >> 3] & ~mask) | (bit ? mask : 0);
 }
 
-static int _traceback(struct vdecoder *dec,
-		       unsigned state, uint8_t *out, int len, int offset)
+static int _traceback(struct vdecoder *dec, unsigned state,
+		      uint8_t *out, int start, int len, int offset)
 {
 	int i;
 	unsigned path;
 
 	for (i = len - 1; i >= 0; i--) {
-		path = dec->paths[i + offset][state] + 1;
-		out[i] = dec->trellis->vals[state];
+		path = vdec_path(dec, i + offset, state);
+		put_bit(out, start + i, dec->trellis->vals[state]);
 		state = vstate_lshift(state, dec->k, path);
 	}
 
 	return state;
 }
 
-static void _traceback_rec(struct vdecoder *dec,
-			   unsigned state, uint8_t *out, int len)
+static void _traceback_rec(struct vdecoder *dec, unsigned state,
+			   uint8_t *out, int start, int len, int offset)
 {
 	int i;
 	unsigned path;
 
 	for (i = len - 1; i >= 0; i--) {
-		path = dec->paths[i][state] + 1;
-		out[i] = path ^ dec->trellis->vals[state];
+		path = vdec_path(dec, i + offset, state);
+		put_bit(out, start + i, path ^ dec->trellis->vals[state]);
 		state = vstate_lshift(state, dec->k, path);
 	}
 }
 
+/* Find the state with the largest accumulated path metric */
+static unsigned max_state(struct vdecoder *dec, int *max, int *max_p)
+{
+	int i, sum;
+	unsigned state = 0;
+
+	*max = -1;
+	*max_p = -1;
+
+	for (i = 0; i < dec->trellis->num_states; i++) {
+		sum = dec->sums[i];
+		if (sum > *max) {
+			*max_p = *max;
+			*max = sum;
+			state = i;
+		}
+	}
+
+	return state;
+}
+
+/* Offset of the first trellis step that generates decoded output */
+static int traceback_offset(struct vdecoder *dec, int term)
+{
+	return term == CONV_TERM_TAIL_BITING ? TAIL_BITING_EXTRA : 0;
+}
+
+/*
+ * Windowed traceback
+ *
+ * Called after each trellis step 'i' in windowed mode. Once 'depth' steps
+ * have been accumulated beyond a block of 'depth' undecoded steps, trace
+ * back from the current best state, discard the first 'depth' steps of
+ * the survivor path, and output the block. Returns the updated number of
+ * decoded bits. The final partial block is handled by traceback().
+ */
+static int traceback_window(struct vdecoder *dec, uint8_t *out,
+			    int term, int len, int i, int done)
+{
+	int max, max_p;
+	int offset = traceback_offset(dec, term);
+	unsigned state;
+
+	if (i + 1 - (offset + done) < 2 * dec->depth)
+		return done;
+	if (done + dec->depth > len)
+		return done;
+
+	state = max_state(dec, &max, &max_p);
+	state = _traceback_skip(dec, state, i, offset + done + dec->depth);
+
+	if (dec->recursive)
+		_traceback_rec(dec, state, out, done, dec->depth, offset + done);
+	else
+		_traceback(dec, state, out, done, dec->depth, offset + done);
+
+	return done + dec->depth;
+}
+
 /*
  * Traceback and generate decoded output
  *
  * For tail biting, find the largest accumulated path metric at the final state
  * followed by two trace back passes. For zero flushing the final state is
  * always zero with a single traceback path.
+ *
+ * In windowed mode, only the bits not already output by traceback_window()
+ * are decoded here, starting at 'done'.
  */
-static int traceback(struct vdecoder *dec, uint8_t *out, int term, int len)
+static int traceback(struct vdecoder *dec, uint8_t *out, int term, int len,
+		     int done)
 {
-	int i, sum, max_p = -1, max = -1;
-	unsigned path, state = 0;
+	int max_p = -1, max = -1;
+	int offset = traceback_offset(dec, term);
+	unsigned state = 0;
 
 	if (term == CONV_TERM_TAIL_BITING) {
-		for (i = 0; i < dec->trellis->num_states; i++) {
-			sum = dec->trellis->sums[i];
-			if (sum > max) {
-				max_p = max;
-				max = sum;
-				state = i;
-			}
-		}
+		state = max_state(dec, &max, &max_p);
 		if (max < 0)
 			return -EPROTO;
-		for (i = dec->len - 1; i >= len + TAIL_BITING_EXTRA; i--) {
-			path = dec->paths[i][state] + 1;
-			state = vstate_lshift(state, dec->k, path);
-		}
-	} else {
-		for (i = dec->len - 1; i >= len; i--) {
-			path = dec->paths[i][state] + 1;
-			state = vstate_lshift(state, dec->k, path);
-		}
 	}
 
+	state = _traceback_skip(dec, state, dec->len - 1, len + offset);
+
 	if (dec->recursive)
-		_traceback_rec(dec, state, out, len);
+		_traceback_rec(dec, state, out, done, len - done, offset + done);
 	else
-		state =_traceback(dec, state, out, len, term == CONV_TERM_TAIL_BITING ? TAIL_BITING_EXTRA : 0);
+		state =_traceback(dec, state, out, done, len - done, offset + done);
 
 	/* Don't handle the odd case of recursize tail-biting codes */
 
@@ -341,9 +522,9 @@ static void free_vdec(struct vdecoder *dec)
 	if (!dec)
 		return;
 
-	free(dec->paths[0]);
+	free(dec->punc_tab);
 	free(dec->paths);
-	free_trellis(dec->trellis);
+	free(dec->sums);
 	free(dec);
 }
 
@@ -353,18 +534,30 @@ static void free_vdec(struct vdecoder *dec)
  * Subtract the constraint length K on the normalization interval to
  * accommodate the initialization path metric at state zero.
  */
-static struct vdecoder *alloc_vdec(const struct lte_conv_code *code)
+static struct vdecoder *alloc_vdec(const struct lte_conv_code *code,
+				   const struct vtrellis *trellis, int depth)
 {
-	int i, ns;
+	int ns;
 	struct vdecoder *dec;
 
 	ns = NUM_STATES(code->k);
 
 	dec = (struct vdecoder *) calloc(1, sizeof(struct vdecoder));
+	if (!dec)
+		return NULL;
+
 	dec->n = code->n;
 	dec->k = code->k;
 	dec->recursive = code->rgen ? 1 : 0;
 	dec->intrvl = INT16_MAX / (dec->n * INT8_MAX) - dec->k;
+	dec->code_len = code->len;
+	dec->term = code->term;
+	dec->trellis = trellis;
+	dec->metric_func = shared_metric_func;
+	if (dec->metric_func == gen_metrics_k7_n3)
+		dec->metric_out = trellis->outputs;
+	else
+		dec->metric_out = trellis->outputs_t;
 
     assert(dec->n == 3);
     assert(dec->k == 7);
@@ -374,14 +567,55 @@ static struct vdecoder *alloc_vdec(const struct lte_conv_code *code)
 	else
 		dec->len = code->len + TAIL_BITING_EXTRA * 2;
 
-	dec->trellis = generate_trellis(code);
-	if (!dec->trellis)
+	dec->sums = vdec_malloc(ns);
+	if (!dec->sums)
+		goto fail;
+
+	/*
+	 * In windowed mode only the undecoded block, the traceback depth and
+	 * the termination steps need to be held at any time.
+	 */
+	if (depth > 0 && 2 * depth + dec->len - code->len < dec->len) {
+		dec->depth = depth;
+		dec->rows = 2 * depth + dec->len - code->len;
+	} else {
+		dec->depth = 0;
+		dec->rows = dec->len;
+	}
+
+	dec->paths = (uint64_t *) malloc(sizeof(uint64_t) * dec->rows);
+	if (!dec->paths)
 		goto fail;
 
-	dec->paths = (int16_t **) malloc(sizeof(int16_t *) * dec->len);
-	dec->paths[0] = vdec_malloc(ns * dec->len);
-	for (i = 1; i < dec->len; i++)
-		dec->paths[i] = &dec->paths[0][i * ns];
+	if (code->punc) {
+		int i, len;
+
+		for (len = 0; code->punc[len] >= 0; len++);
+		assert(len > 0 && len % dec->n == 0);
+
+		dec->punc = code->punc;
+		dec->punc_steps = len / dec->n;
+		dec->punc_tab = (struct punc_step *)
+			calloc(dec->punc_steps, sizeof(struct punc_step));
+		if (!dec->punc_tab)
+			goto fail;
+
+		for (i = 0; i < len; i++) {
+			struct punc_step *ps = &dec->punc_tab[i / dec->n];
+
+			if (i % dec->n == 0)
+				ps->pos = dec->punc_kept;
+			if (code->punc[i]) {
+				ps->off[i % dec->n] = ps->kept++;
+				ps->mask[i % dec->n] = -1;
+				dec->punc_kept++;
+			}
+		}
+
+		/* Punctured bits read the step's first bit, so it must exist */
+		for (i = 0; i < dec->punc_steps; i++)
+			assert(dec->punc_tab[i].kept > 0);
+	}
 
 	return dec;
 fail:
@@ -389,6 +623,45 @@ fail:
 	return NULL;
 }
 
+/*
+ * Punctured input position
+ *
+ * Soft bits for each trellis step are gathered from the punctured sequence,
+ * with zeros (erasures) for the punctured bits, so that no depunctured copy
+ * of the frame is needed.
+ *
+ * step - Step within the puncturing period
+ * pos  - Offset of the next transmitted bit in the punctured sequence
+ */
+struct punc_cursor {
+	int step;
+	int pos;
+};
+
+static void punc_seek(struct vdecoder *dec, struct punc_cursor *c, int j)
+{
+	c->step = j % dec->punc_steps;
+	c->pos = (j / dec->punc_steps) * dec->punc_kept + dec->punc_tab[c->step].pos;
+}
+
+static inline const int8_t *punc_next(struct vdecoder *dec,
+				      struct punc_cursor *c,
+				      const int8_t *seq, int8_t *val)
+{
+	const struct punc_step *ps = &dec->punc_tab[c->step];
+
+	seq += c->pos;
+	val[0] = seq[ps->off[0]] & ps->mask[0];
+	val[1] = seq[ps->off[1]] & ps->mask[1];
+	val[2] = seq[ps->off[2]] & ps->mask[2];
+
+	c->pos += ps->kept;
+	if (++c->step == dec->punc_steps)
+		c->step = 0;
+
+	return val;
+}
+
 /*
  * Forward trellis recursion
  *
@@ -396,63 +669,64 @@ fail:
  * accumulated path metric sums and path selections are stored. Normalize on
  * the interval specified by the decoder.
  */
-static void _conv_decode(struct vdecoder *dec, const int8_t *seq, int term, int len)
+static int _conv_decode(struct vdecoder *dec, const int8_t *seq, uint8_t *out,
+			int term, int len)
 {
-	int i, j = 0;
-	struct vtrellis *trellis = dec->trellis;
+	int i, j = 0, done = 0;
+	int8_t val[4];
+	struct punc_cursor cursor = { 0, 0 };
 
 	if (term == CONV_TERM_TAIL_BITING)
 		j = len - TAIL_BITING_EXTRA;
+	if (dec->punc)
+		punc_seek(dec, &cursor, j);
 
 	for (i = 0; i < dec->len; i++, j++) {
-		if (term == CONV_TERM_TAIL_BITING && j == len)
+		if (term == CONV_TERM_TAIL_BITING && j == len) {
 			j = 0;
+			if (dec->punc)
+				punc_seek(dec, &cursor, j);
+		}
 
-		gen_metrics_k7_n3(&seq[dec->n * j],
-				 trellis->outputs,
-				 trellis->sums,
-				 dec->paths[i],
+		dec->metric_func(dec->punc ? punc_next(dec, &cursor, seq, val) : &seq[dec->n * j],
+				 dec->metric_out,
+				 dec->sums,
+				 vdec_paths(dec, i),
 				 !(i % dec->intrvl));
+
+		if (dec->depth)
+			done = traceback_window(dec, out, term, len, i, done);
 	}
+
+	return done;
 }
 
-static int nrsc5_conv_decode(const int8_t *in, uint8_t *out, int len)
+struct vdecoder *nrsc5_conv_alloc(int len, int depth, const int *punc)
 {
-	const struct lte_conv_code code = {
-		.n = 3,
-		.k = 7,
-		.len = len,
-		.gen = { 0133, 0171, 0165 },
-		.term = CONV_TERM_TAIL_BITING,
-	};
-	int rc;
-
-	struct vdecoder *vdec = alloc_vdec(&code);
-	if (!vdec)
-		return -EFAULT;
-
-	reset_decoder(vdec, code.term);
+	struct lte_conv_code code = nrsc5_code;
 
-	/* Propagate through the trellis with interval normalization */
-	_conv_decode(vdec, in, code.term, code.len);
-
-	rc = traceback(vdec, out, code.term, code.len);
+	pthread_once(&shared_trellis_once, init_shared_trellis);
+	if (!shared_trellis)
+		return NULL;
 
-	free_vdec(vdec);
-	return rc;
+	code.len = len;
+	code.punc = punc;
+	return alloc_vdec(&code, shared_trellis, depth);
 }
 
-int nrsc5_conv_decode_p1(const int8_t *in, uint8_t *out)
+void nrsc5_conv_free(struct vdecoder *dec)
 {
-	return nrsc5_conv_decode(in, out, P1_FRAME_LEN);
+	free_vdec(dec);
 }
 
-int nrsc5_conv_decode_pids(const int8_t *in, uint8_t *out)
+int nrsc5_conv_decode(struct vdecoder *dec, const int8_t *in, uint8_t *out)
 {
-	return nrsc5_conv_decode(in, out, PIDS_FRAME_LEN);
-}
+	int done;
 
-int nrsc5_conv_decode_p3(const int8_t *in, uint8_t *out)
-{
-	return nrsc5_conv_decode(in, out, P3_FRAME_LEN);
+	reset_decoder(dec, dec->term);
+
+	/* Propagate through the trellis with interval normalization */
+	done = _conv_decode(dec, in, out, dec->term, dec->code_len);
+
+	return traceback(dec, out, dec->term, dec->code_len, done);
 }
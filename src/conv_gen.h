@@ -25,13 +25,13 @@
 /*
  * Add-Compare-Select (ACS-Butterfly)
  *
- * Compute 4 accumulated path metrics and 4 path selections. Note that path
- * selections are store as -1 and 0 rather than 0 and 1. This is to match
- * the output format of the sse packed compare instruction 'pmaxuw'.
+ * Compute 4 accumulated path metrics and 4 path selections. Path selections
+ * are packed one bit per state, with a set bit where the sse packed compare
+ * instruction 'pcmpgtw' would return -1.
  */
 static void acs_butterfly(int state, int num_states,
 			  int16_t metric, int16_t *sum,
-			  int16_t *new_sum, int16_t *path)
+			  int16_t *new_sum, uint64_t *path)
 {
 	int state0, state1;
 	int sum0, sum1, sum2, sum3;
@@ -46,18 +46,16 @@ static void acs_butterfly(int state, int num_states,
 
 	if (sum0 > sum1) {
 		*new_sum = sum0;
-		*path = -1;
+		*path |= (uint64_t) 1 << state;
 	} else {
 		*new_sum = sum1;
-		*path = 0;
 	}
 
 	if (sum2 > sum3) {
 		*(new_sum + num_states / 2) = sum2;
-		*(path + num_states / 2) = -1;
+		*path |= (uint64_t) 1 << (state + num_states / 2);
 	} else {
 		*(new_sum + num_states / 2) = sum3;
-		*(path + num_states / 2) = 0;
 	}
 }
 
@@ -75,15 +73,16 @@ static void _gen_branch_metrics_n3(int num_states, const int8_t *seq,
 
 /* Path metric unit */
 static void _gen_path_metrics(int num_states, int16_t *sums,
-		       int16_t *metrics, int16_t *paths, int norm)
+		       int16_t *metrics, uint64_t *paths, int norm)
 {
 	int i;
 	int16_t min;
 	int16_t new_sums[num_states];
 
+	*paths = 0;
 	for (i = 0; i < num_states / 2; i++) {
 		acs_butterfly(i, num_states, metrics[i],
-			      sums, &new_sums[i], &paths[i]);
+			      sums, &new_sums[i], paths);
 	}
 
 	if (norm) {
@@ -101,7 +100,7 @@ static void _gen_path_metrics(int num_states, int16_t *sums,
 }
 
 static void gen_metrics_k7_n3(const int8_t *seq, const int16_t *out,
-		       int16_t *sums, int16_t *paths, int norm)
+		       int16_t *sums, uint64_t *paths, int norm)
 {
 	int16_t metrics[32];
 
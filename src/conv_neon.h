@@ -78,11 +78,39 @@
     M6 = vqsubq_s16(M6, M8); \
     M7 = vqsubq_s16(M7, M8); \
 }
+/*
+ * Pack path decisions
+ *
+ * Narrow eight registers of 16-bit path selections (0 or -1) for states
+ * 0-63 to bytes, mask each lane with its bit position and add pairwise
+ * until each byte holds the decision bits of 8 consecutive states.
+ */
+#define NEON_PACK_PATHS(M0,M1,M2,M3,M4,M5,M6,M7,OUT) \
+{ \
+    const uint8x8_t bits = vcreate_u8(0x8040201008040201ULL); \
+    uint8x8_t p0 = vand_u8(vmovn_u16(vreinterpretq_u16_s16(M0)), bits); \
+    uint8x8_t p1 = vand_u8(vmovn_u16(vreinterpretq_u16_s16(M1)), bits); \
+    uint8x8_t p2 = vand_u8(vmovn_u16(vreinterpretq_u16_s16(M2)), bits); \
+    uint8x8_t p3 = vand_u8(vmovn_u16(vreinterpretq_u16_s16(M3)), bits); \
+    uint8x8_t p4 = vand_u8(vmovn_u16(vreinterpretq_u16_s16(M4)), bits); \
+    uint8x8_t p5 = vand_u8(vmovn_u16(vreinterpretq_u16_s16(M5)), bits); \
+    uint8x8_t p6 = vand_u8(vmovn_u16(vreinterpretq_u16_s16(M6)), bits); \
+    uint8x8_t p7 = vand_u8(vmovn_u16(vreinterpretq_u16_s16(M7)), bits); \
+    p0 = vpadd_u8(p0, p1); \
+    p2 = vpadd_u8(p2, p3); \
+    p4 = vpadd_u8(p4, p5); \
+    p6 = vpadd_u8(p6, p7); \
+    p0 = vpadd_u8(p0, p2); \
+    p4 = vpadd_u8(p4, p6); \
+    p0 = vpadd_u8(p0, p4); \
+    OUT = vget_lane_u64(vreinterpret_u64_u8(p0), 0); \
+}
 __always_inline static void _neon_metrics_k7_n4(const int16_t *val, const int16_t *out,
-					int16_t *sums, int16_t *paths, int norm)
+					int16_t *sums, uint64_t *paths, int norm)
 {
     int16x8_t m0, m1, m2, m3, m4, m5, m6, m7;
     int16x8_t m8, m9, m10, m11, m12, m13, m14, m15;
+    int16x8_t p0, p1, p4, p5;
     int16x4_t input;
 
 	/* (PMU) Load accumulated path matrics */
@@ -136,19 +164,16 @@ __always_inline static void _neon_metrics_k7_n4(const int16_t *val, const int16_
 	NEON_BUTTERFLY(m8, m9, m4, m0, m1)
 	NEON_BUTTERFLY(m10, m11, m5, m2, m3)
 
-    vst1q_s16(&paths[0], m0);
-    vst1q_s16(&paths[8], m2);
-    vst1q_s16(&paths[32], m9);
-    vst1q_s16(&paths[40], m11);
+    p0 = m0;
+    p1 = m2;
+    p4 = m9;
+    p5 = m11;
 
 	/* (PMU) Butterflies: 17-31 */
 	NEON_BUTTERFLY(m12, m13, m6, m0, m2)
 	NEON_BUTTERFLY(m14, m15, m7, m9, m11)
 
-    vst1q_s16(&paths[16], m0);
-    vst1q_s16(&paths[24], m9);
-    vst1q_s16(&paths[48], m13);
-    vst1q_s16(&paths[56], m15);
+    NEON_PACK_PATHS(p0, p1, m0, m9, p4, p5, m13, m15, *paths)
 
 	if (norm)
 		NEON_NORMALIZE_K7(m4, m1, m5, m3, m6, m2,
@@ -165,7 +190,7 @@ __always_inline static void _neon_metrics_k7_n4(const int16_t *val, const int16_
 }
 
 static inline void gen_metrics_k7_n3(const int8_t *val, const int16_t *out,
-		       int16_t *sums, int16_t *paths, int norm)
+		       int16_t *sums, uint64_t *paths, int norm)
 {
 	const int16_t _val[4] = { val[0], val[1], val[2], 0 };
 
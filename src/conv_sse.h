@@ -227,6 +227,21 @@
 	M7  = _mm_subs_epi16(M7, M8); \
 }
 
+/*
+ * Pack path decisions
+ *
+ * Narrow two registers of 16-bit path selections (0 or -1) to bytes and
+ * collect the sign bits, giving one decision bit per state.
+ *
+ * Input:
+ * M0:1 - Path selections (packed 16-bit integers)
+ *
+ * Output:
+ * Returns 16 packed path decision bits
+ */
+#define SSE_PACK_PATHS(M0,M1) \
+	((uint64_t) _mm_movemask_epi8(_mm_packs_epi16(M0, M1)))
+
 /*
  * Combined BMU/PMU (K=7, N=3 and N=4)
  *
@@ -235,7 +250,7 @@
  * metrics before computing branch metrics as in the half rate case.
  */
 __always_inline void _sse_metrics_k7_n4(const int16_t *val, const int16_t *out,
-					int16_t *sums, int16_t *paths, int norm)
+					int16_t *sums, uint64_t *paths, int norm)
 {
 	__m128i m0, m1, m2, m3, m4, m5, m6, m7;
 	__m128i m8, m9, m10, m11, m12, m13, m14, m15;
@@ -290,19 +305,14 @@ __always_inline void _sse_metrics_k7_n4(const int16_t *val, const int16_t *out,
 	SSE_BUTTERFLY(m8, m9, m4, m0, m1)
 	SSE_BUTTERFLY(m10, m11, m5, m2, m3)
 
-	_mm_store_si128((__m128i *) &paths[0], m0);
-	_mm_store_si128((__m128i *) &paths[8], m2);
-	_mm_store_si128((__m128i *) &paths[32], m9);
-	_mm_store_si128((__m128i *) &paths[40], m11);
+	*paths = SSE_PACK_PATHS(m0, m2) | (SSE_PACK_PATHS(m9, m11) << 32);
 
 	/* (PMU) Butterflies: 17-31 */
 	SSE_BUTTERFLY(m12, m13, m6, m0, m2)
 	SSE_BUTTERFLY(m14, m15, m7, m9, m11)
 
-	_mm_store_si128((__m128i *) &paths[16], m0);
-	_mm_store_si128((__m128i *) &paths[24], m9);
-	_mm_store_si128((__m128i *) &paths[48], m13);
-	_mm_store_si128((__m128i *) &paths[56], m15);
+	*paths |= (SSE_PACK_PATHS(m0, m9) << 16) |
+		  (SSE_PACK_PATHS(m13, m15) << 48);
 
 	if (norm)
 		SSE_NORMALIZE_K7(m4, m1, m5, m3, m6, m2,
@@ -319,7 +329,7 @@ __always_inline void _sse_metrics_k7_n4(const int16_t *val, const int16_t *out,
 }
 
 static void gen_metrics_k7_n3(const int8_t *val, const int16_t *out,
-		       int16_t *sums, int16_t *paths, int norm)
+		       int16_t *sums, uint64_t *paths, int norm)
 {
 	const int16_t _val[4] = { val[0], val[1], val[2], 0 };
 
@@ -0,0 +1,117 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+
+#include "crc.h"
+
+// Slicing-by-8 tables. Table k advances the CRC over a byte followed by k
+// zero bytes, so eight bytes can be folded in with independent lookups.
+static uint8_t crc8_tab[8][256];
+static uint16_t fcs16_tab[8][256];
+static uint16_t crc12_tab[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void init_tables(void)
+{
+    unsigned int i, k;
+
+    for (i = 0; i < 256; i++)
+    {
+        uint8_t c8 = i;
+        uint16_t c16 = i, c12 = i;
+
+        for (k = 0; k < 8; k++)
+        {
+            c8 = (c8 << 1) ^ ((c8 & 0x80) ? 0x31 : 0);
+            c16 = (c16 >> 1) ^ ((c16 & 1) ? 0x8408 : 0);
+            c12 = (c12 >> 1) ^ ((c12 & 1) ? 0xD010 : 0);
+        }
+        crc8_tab[0][i] = c8;
+        fcs16_tab[0][i] = c16;
+        crc12_tab[i] = c12;
+    }
+
+    for (k = 1; k < 8; k++)
+    {
+        for (i = 0; i < 256; i++)
+        {
+            crc8_tab[k][i] = crc8_tab[0][crc8_tab[k - 1][i]];
+            fcs16_tab[k][i] = (fcs16_tab[k - 1][i] >> 8) ^ fcs16_tab[0][fcs16_tab[k - 1][i] & 0xFF];
+        }
+    }
+}
+
+void crc_init(void)
+{
+    pthread_once(&crc_once, init_tables);
+}
+
+uint8_t crc8(const uint8_t *buf, unsigned int len)
+{
+    unsigned int crc = 0xFF;
+
+    for (; len >= 8; len -= 8, buf += 8)
+    {
+        crc = crc8_tab[7][crc ^ buf[0]] ^ crc8_tab[6][buf[1]]
+              ^ crc8_tab[5][buf[2]] ^ crc8_tab[4][buf[3]]
+              ^ crc8_tab[3][buf[4]] ^ crc8_tab[2][buf[5]]
+              ^ crc8_tab[1][buf[6]] ^ crc8_tab[0][buf[7]];
+    }
+    while (len--)
+        crc = crc8_tab[0][crc ^ *buf++];
+    return crc;
+}
+
+uint16_t fcs16(const uint8_t *buf, unsigned int len)
+{
+    unsigned int crc = 0xFFFF;
+
+    for (; len >= 8; len -= 8, buf += 8)
+    {
+        unsigned int x = crc ^ buf[0] ^ (buf[1] << 8);
+        crc = fcs16_tab[7][x & 0xFF] ^ fcs16_tab[6][x >> 8]
+              ^ fcs16_tab[5][buf[2]] ^ fcs16_tab[4][buf[3]]
+              ^ fcs16_tab[3][buf[4]] ^ fcs16_tab[2][buf[5]]
+              ^ fcs16_tab[1][buf[6]] ^ fcs16_tab[0][buf[7]];
+    }
+    while (len--)
+        crc = (crc >> 8) ^ fcs16_tab[0][(crc ^ *buf++) & 0xFF];
+    return crc;
+}
+
+// The register is shifted right with each message bit entering at the top,
+// last bit first, followed by 16 zero bits. Input bits don't reach the
+// bottom of the register within a byte, so whole bytes can be shifted in.
+uint16_t crc12(const uint8_t *buf)
+{
+    unsigned int i, reg = 0;
+
+    // bits 67 to 64
+    for (i = 4; i < 8; i++)
+    {
+        unsigned int lowbit = reg & 1;
+        reg >>= 1;
+        reg ^= ((buf[8] >> i) & 1) << 15;
+        if (lowbit) reg ^= 0xD010;
+    }
+    for (i = 8; i > 0; i--)
+        reg = crc12_tab[reg & 0xFF] ^ (reg >> 8) ^ (buf[i - 1] << 8);
+    for (i = 0; i < 2; i++)
+        reg = crc12_tab[reg & 0xFF] ^ (reg >> 8);
+
+    reg ^= 0x955;
+    return reg & 0xfff;
+}
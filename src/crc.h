@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdint.h>
+
+void crc_init(void);
+// CRC-8 of audio packets, polynomial 0x31
+uint8_t crc8(const uint8_t *buf, unsigned int len);
+// HDLC frame check sequence, as in PPP (RFC 1662)
+uint16_t fcs16(const uint8_t *buf, unsigned int len);
+// CRC-12 of the first 68 bits of a PIDS frame, packed MSB first
+uint16_t crc12(const uint8_t *buf);
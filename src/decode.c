@@ -13,6 +13,8 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "config.h"
+
 #include <string.h>
 
 #include "conv.h"
@@ -21,61 +23,116 @@
 #include "pids.h"
 #include "private.h"
 
-// calculate channel bit error rate by re-encoding and comparing to the input
-static float calc_cber(int8_t *coded, uint8_t *decoded)
+// Expected coded bits for a byte of decoded bits, one table per encoder
+// output, spread to their positions among the 20 transmitted bits. The third
+// output of odd bits is punctured, [1, 1, 1, 1, 1, 0].
+static uint32_t cber_spread[3][256];
+
+// one bit per soft value, set if the value is positive
+static inline uint64_t positive_bits(const int8_t *p)
 {
-    uint8_t r = 0;
-    unsigned int i, j, errors = 0;
+    uint64_t x, nonzero;
 
+    memcpy(&x, p, sizeof(x));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    x = __builtin_bswap64(x);
+#endif
+    nonzero = ((x & 0x7f7f7f7f7f7f7f7fULL) + 0x7f7f7f7f7f7f7f7fULL) | x;
+    x = (nonzero & ~x & 0x8080808080808080ULL) >> 7;
+    return (x * 0x0102040810204080ULL) >> 56;
+}
+
+// calculate channel bit error rate by re-encoding and comparing to the input
+static float calc_cber(const int8_t *coded, const uint8_t *decoded)
+{
+    unsigned int i, errors = 0;
     // tail biting
-    for (i = 0; i < 6; i++)
-        r = (r >> 1) | (decoded[P1_FRAME_LEN - 6 + i] << 6);
+    uint32_t prev = decoded[P1_FRAME_LEN / 8 - 1];
 
-    for (i = 0, j = 0; i < P1_FRAME_LEN; i++)
+    // 16 decoded bits, and 40 coded bits, at a time
+    for (i = 0; i < P1_FRAME_LEN / 8; i += 2)
     {
-        // shift in new bit
-        r = (r >> 1) | (decoded[i] << 6);
+        const int8_t *c = &coded[i * 20];
+        uint32_t w = prev | (decoded[i] << 8) | (decoded[i + 1] << 16);
+        uint32_t e0 = (w >> 8) ^ (w >> 6) ^ (w >> 5) ^ (w >> 3) ^ (w >> 2);
+        uint32_t e1 = (w >> 8) ^ (w >> 7) ^ (w >> 6) ^ (w >> 5) ^ (w >> 2);
+        uint32_t e2 = (w >> 8) ^ (w >> 7) ^ (w >> 6) ^ (w >> 4) ^ (w >> 2);
+        uint64_t expected, received;
 
-        if ((coded[j++] > 0) != __builtin_parity(r & 0133))
-            errors++;
+        expected = cber_spread[0][e0 & 0xff] | cber_spread[1][e1 & 0xff] | cber_spread[2][e2 & 0xff];
+        expected |= (uint64_t) (cber_spread[0][(e0 >> 8) & 0xff] | cber_spread[1][(e1 >> 8) & 0xff]
+                                | cber_spread[2][(e2 >> 8) & 0xff]) << 20;
+        received = positive_bits(c) | (positive_bits(c + 8) << 8) | (positive_bits(c + 16) << 16)
+                   | (positive_bits(c + 24) << 24) | (positive_bits(c + 32) << 32);
+        errors += __builtin_popcountll(expected ^ received);
 
-        if ((coded[j++] > 0) != __builtin_parity(r & 0171))
-            errors++;
-
-        if ((j % 6) == 5)
-            j++;
-        else if ((coded[j++] > 0) != __builtin_parity(r & 0165))
-            errors++;
+        prev = decoded[i + 1];
     }
 
     return (float) errors / P1_FRAME_LEN_ENCODED;
 }
 
+// Scrambler keystream, packed like the decoded bits. Every logical channel
+// restarts the scrambler at the start of its frame, so they share one stream.
+static uint8_t keystream[P1_FRAME_LEN / 8];
+
 static void descramble(uint8_t *buf, unsigned int length)
 {
-    const unsigned int width = 11;
-    unsigned int i, val = 0x3ff;
-    for (i = 0; i < length; i += 8)
-    {
-        unsigned int j;
-        for (j = 0; j < 8; ++j)
-        {
-            int bit = ((val >> 9) ^ val) & 1;
-            val |= bit << width;
-            val >>= 1;
-            buf[i + j] ^= bit;
-        }
-    }
+    unsigned int i;
+    for (i = 0; i < length / 8; i++)
+        buf[i] ^= keystream[i];
 }
 
-void decode_process_p1(decode_t *st)
+// P3 interleaver length, in bits
+#define P3_INTERLEAVER_LEN 147456
+
+// Deinterleaver permutations, shared by all decoders. Entry i is the position
+// in the interleaver buffer of encoded bit i.
+static uint32_t perm_p1[P1_FRAME_LEN_ENCODED];
+// relative to the start of the L1 block holding the PIDS frame
+static uint32_t perm_pids[PIDS_FRAME_LEN_ENCODED];
+// indexed by position in the P3 interleaver, which is filled continuously
+static uint32_t perm_p3[P3_INTERLEAVER_LEN];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+static void init_tables(void)
 {
     const int J = 20, B = 16, C = 36;
     const int8_t v[] = {
         10, 2, 18, 6, 14, 8, 16, 0, 12, 4,
         11, 3, 19, 7, 15, 9, 17, 1, 13, 5
     };
-    unsigned int i, out = 0;
+    const unsigned int width = 11;
+    unsigned int i, val = 0x3ff;
+
+    for (i = 0; i < P1_FRAME_LEN; i++)
+    {
+        unsigned int bit = ((val >> 9) ^ val) & 1;
+        val |= bit << width;
+        val >>= 1;
+        keystream[i >> 3] |= bit << (i & 7);
+    }
+
+    for (i = 0; i < 256; i++)
+    {
+        unsigned int t;
+        for (t = 0; t < 8; t++)
+        {
+            unsigned int bit = (i >> t) & 1, pos = (t / 2) * 5;
+            if (t % 2 == 0)
+            {
+                cber_spread[0][i] |= bit << pos;
+                cber_spread[1][i] |= bit << (pos + 1);
+                cber_spread[2][i] |= bit << (pos + 2);
+            }
+            else
+            {
+                cber_spread[0][i] |= bit << (pos + 3);
+                cber_spread[1][i] |= bit << (pos + 4);
+            }
+        }
+    }
+
     for (i = 0; i < P1_FRAME_LEN_ENCODED; i++)
     {
         int partition = v[i % J];
@@ -83,69 +140,172 @@ void decode_process_p1(decode_t *st)
         int k = i / (J * B);
         int row = (k * 11) % 32;
         int column = (k * 11 + k / (32*9)) % C;
-        st->viterbi_p1[out++] = st->buffer_pm[(block * 32 + row) * 720 + partition * C + column];
-        if ((out % 6) == 5) // depuncture, [1, 1, 1, 1, 1, 0]
-            st->viterbi_p1[out++] = 0;
+        perm_p1[i] = (block * 32 + row) * 720 + partition * C + column;
     }
 
-    nrsc5_conv_decode_p1(st->viterbi_p1, st->scrambler_p1);
-    nrsc5_report_ber(st->input->radio, calc_cber(st->viterbi_p1, st->scrambler_p1));
-    descramble(st->scrambler_p1, P1_FRAME_LEN);
-    frame_push(&st->input->frame, st->scrambler_p1, P1_FRAME_LEN);
-}
-
-void decode_process_pids(decode_t *st)
-{
-    const int J = 20, B = 16, C = 36;
-    const int8_t v[] = {
-        10, 2, 18, 6, 14, 8, 16, 0, 12, 4,
-        11, 3, 19, 7, 15, 9, 17, 1, 13, 5
-    };
-    unsigned int i, out = 0;
     for (i = 0; i < PIDS_FRAME_LEN_ENCODED; i++)
     {
         int partition = v[i % J];
-        int block = decode_get_block(st) - 1;
         int k = ((i / J) % (PIDS_FRAME_LEN_ENCODED / J)) + (P1_FRAME_LEN_ENCODED / (J * B));
         int row = (k * 11) % 32;
         int column = (k * 11 + k / (32*9)) % C;
-        st->viterbi_pids[out++] = st->buffer_pm[(block * 32 + row) * 720 + partition * C + column];
-        if ((out % 6) == 5) // depuncture, [1, 1, 1, 1, 1, 0]
-            st->viterbi_pids[out++] = 0;
+        perm_pids[i] = row * 720 + partition * C + column;
+    }
+
+    {
+        const unsigned int J = 4, B = 32, C = 36, M = 2;
+        const unsigned int bk_bits = 32 * C;
+        const unsigned int bk_adj = 32 * C - 1;
+        unsigned int pt[4] = { 0 };
+
+        // the counters in pt repeat with the same period as the interleaver
+        for (i = 0; i < P3_INTERLEAVER_LEN; i++)
+        {
+            int partition = ((i + 2 * (M / 4)) / M) % J;
+            unsigned int pti = pt[partition]++;
+            int block = (pti + (partition * 7) - (bk_adj * (pti / bk_bits))) % B;
+            int row = ((11 * pti) % bk_bits) / C;
+            int column = (pti * 11) % C;
+            perm_p3[i] = (block * 32 + row) * 144 + partition * C + column;
+        }
+    }
+}
+
+// Puncturing patterns of the rate 1/3 mother code. The Viterbi decoder reads
+// the punctured bits directly.
+static const int punc_p1[] = { 1, 1, 1, 1, 1, 0, -1 };
+static const int punc_p3[] = { 1, 0, 1, 1, 0, 1, -1 };
+
+static void deinterleave(const int8_t *in, const uint32_t *perm, unsigned int len, int8_t *out)
+{
+    unsigned int i;
+    for (i = 0; i < len; i++)
+        out[i] = in[perm[i]];
+}
+
+static void decode_process_p1(decode_t *st, const int8_t *buffer_pm)
+{
+    unsigned int ber_interval = atomic_load(&st->ber_interval);
+
+    deinterleave(buffer_pm, perm_p1, P1_FRAME_LEN_ENCODED, st->viterbi_p1);
+
+    nrsc5_conv_decode(st->vdec_p1, st->viterbi_p1, st->scrambler_p1);
+    if (ber_interval && ++st->ber_count >= ber_interval)
+    {
+        st->ber_count = 0;
+        nrsc5_report_ber(st->input->radio, calc_cber(st->viterbi_p1, st->scrambler_p1));
+    }
+    descramble(st->scrambler_p1, P1_FRAME_LEN);
+    frame_push(&st->input->frame, st->scrambler_p1, P1_FRAME_LEN);
+}
+
+// P1 frames are decoded on a separate thread so that demodulation can continue
+static void *decode_worker(void *arg)
+{
+    decode_t *st = arg;
+
+    pthread_mutex_lock(&st->mutex);
+    while (!st->worker_closed)
+    {
+        if (st->pm_queued == 0)
+        {
+            pthread_cond_wait(&st->cond, &st->mutex);
+            continue;
+        }
+
+        unsigned int idx = (st->pm_fill + DECODE_PM_BUFFERS - st->pm_queued) % DECODE_PM_BUFFERS;
+        st->worker_busy = 1;
+        pthread_mutex_unlock(&st->mutex);
+
+        decode_process_p1(st, st->buffer_pm[idx]);
+
+        pthread_mutex_lock(&st->mutex);
+        st->worker_busy = 0;
+        st->pm_queued--;
+        pthread_cond_broadcast(&st->cond);
+    }
+    pthread_mutex_unlock(&st->mutex);
+
+    return NULL;
+}
+
+void decode_queue_p1(decode_t *st)
+{
+    pthread_mutex_lock(&st->mutex);
+    if (st->pm_queued == DECODE_PM_BUFFERS - 1)
+    {
+        if (st->input->radio->dev)
+        {
+            // live input can't be paused, so drop the frame
+            st->pm_dropped++;
+            log_debug("Decoder busy, dropped P1 frame (%u total)", st->pm_dropped);
+            pthread_mutex_unlock(&st->mutex);
+            return;
+        }
+
+        // otherwise apply backpressure to the sample source
+        while (st->pm_queued == DECODE_PM_BUFFERS - 1)
+            pthread_cond_wait(&st->cond, &st->mutex);
     }
 
-    nrsc5_conv_decode_pids(st->viterbi_pids, st->scrambler_pids);
+    st->pm_queued++;
+    st->pm_fill = (st->pm_fill + 1) % DECODE_PM_BUFFERS;
+    pthread_cond_broadcast(&st->cond);
+    pthread_mutex_unlock(&st->mutex);
+}
+
+// wait until all queued P1 frames have been decoded
+void decode_wait(decode_t *st)
+{
+    pthread_mutex_lock(&st->mutex);
+    while (st->pm_queued > 0)
+        pthread_cond_wait(&st->cond, &st->mutex);
+    pthread_mutex_unlock(&st->mutex);
+}
+
+unsigned int decode_get_dropped(decode_t *st)
+{
+    unsigned int dropped;
+
+    pthread_mutex_lock(&st->mutex);
+    dropped = st->pm_dropped;
+    pthread_mutex_unlock(&st->mutex);
+
+    return dropped;
+}
+
+void decode_process_pids(decode_t *st)
+{
+    unsigned int block = decode_get_block(st) - 1;
+    deinterleave(&st->buffer_pm[st->pm_fill][block * 32 * 720], perm_pids, PIDS_FRAME_LEN_ENCODED, st->viterbi_pids);
+
+    nrsc5_conv_decode(st->vdec_pids, st->viterbi_pids, st->scrambler_pids);
     descramble(st->scrambler_pids, PIDS_FRAME_LEN);
     pids_frame_push(&st->pids, st->scrambler_pids);
 }
 
 void decode_process_p3(decode_t *st)
 {
-    const unsigned int J = 4, B = 32, C = 36, M = 2, N = 147456;
-    const unsigned int bk_bits = 32 * C;
-    const unsigned int bk_adj = 32 * C - 1;
-    unsigned int i, out = 0;
+    const uint32_t *perm = &perm_p3[st->i_p3];
+    int8_t *internal = &st->internal_p3[st->i_p3];
+    unsigned int i;
+
+    // each bit is read out of the interleaver before the new bit is written
+    // at the same position
     for (i = 0; i < P3_FRAME_LEN_ENCODED; i++)
     {
-        int partition = ((st->i_p3 + 2 * (M / 4)) / M) % J;
-        unsigned int pti = (st->pt_p3[partition])++;
-        int block = (pti + (partition * 7) - (bk_adj * (pti / bk_bits))) % B;
-        int row = ((11 * pti) % bk_bits) / C;
-        int column = (pti * 11) % C;
-        st->viterbi_p3[out++] = st->internal_p3[(block * 32 + row) * 144 + partition * C + column];
-        if ((out % 6) == 1 || (out % 6) == 4) // depuncture, [1, 0, 1, 1, 0, 1]
-            st->viterbi_p3[out++] = 0;
-
-        st->internal_p3[st->i_p3] = st->buffer_px1[i];
-        (st->i_p3)++;
+        st->viterbi_p3[i] = st->internal_p3[perm[i]];
+        internal[i] = st->buffer_px1[i];
     }
+    st->i_p3 += P3_FRAME_LEN_ENCODED;
+
     if (st->ready_p3)
     {
-        nrsc5_conv_decode_p3(st->viterbi_p3, st->scrambler_p3);
+        nrsc5_conv_decode(st->vdec_p3, st->viterbi_p3, st->scrambler_p3);
         descramble(st->scrambler_p3, P3_FRAME_LEN);
         frame_push(&st->input->frame, st->scrambler_p3, P3_FRAME_LEN);
     }
-    if (st->i_p3 == N)
+    if (st->i_p3 == P3_INTERLEAVER_LEN)
     {
         st->i_p3 = 0;
         st->ready_p3 = 1;
@@ -154,16 +314,64 @@ void decode_process_p3(decode_t *st)
 
 void decode_reset(decode_t *st)
 {
+    // discard queued P1 frames, but let the one being decoded finish
+    pthread_mutex_lock(&st->mutex);
+    while (st->worker_busy)
+        pthread_cond_wait(&st->cond, &st->mutex);
+    st->pm_queued = 0;
+    pthread_cond_broadcast(&st->cond);
+    pthread_mutex_unlock(&st->mutex);
+
     st->idx_pm = 0;
     st->idx_px1 = 0;
     st->i_p3 = 0;
     st->ready_p3 = 0;
-    memset(st->pt_p3, 0, sizeof(unsigned int) * 4);
     pids_init(&st->pids, st->input);
 }
 
-void decode_init(decode_t *st, struct input_t *input)
+int decode_init(decode_t *st, struct input_t *input)
 {
+    pthread_once(&tables_once, init_tables);
+
     st->input = input;
+    st->vdec_p1 = nrsc5_conv_alloc(P1_FRAME_LEN, VITERBI_TRACEBACK_DEPTH, punc_p1);
+    st->vdec_pids = nrsc5_conv_alloc(PIDS_FRAME_LEN, VITERBI_TRACEBACK_DEPTH, punc_p1);
+    st->vdec_p3 = nrsc5_conv_alloc(P3_FRAME_LEN, VITERBI_TRACEBACK_DEPTH, punc_p3);
+    if (!st->vdec_p1 || !st->vdec_pids || !st->vdec_p3)
+    {
+        nrsc5_conv_free(st->vdec_p1);
+        nrsc5_conv_free(st->vdec_pids);
+        nrsc5_conv_free(st->vdec_p3);
+        return 1;
+    }
+
+    st->pm_fill = 0;
+    st->pm_queued = 0;
+    st->pm_dropped = 0;
+    atomic_init(&st->ber_interval, 1);
+    st->ber_count = 0;
+    st->worker_busy = 0;
+    st->worker_closed = 0;
+    pthread_mutex_init(&st->mutex, NULL);
+    pthread_cond_init(&st->cond, NULL);
+    pthread_create(&st->worker, NULL, decode_worker, st);
+
     decode_reset(st);
+    return 0;
+}
+
+void decode_free(decode_t *st)
+{
+    pthread_mutex_lock(&st->mutex);
+    st->worker_closed = 1;
+    pthread_cond_broadcast(&st->cond);
+    pthread_mutex_unlock(&st->mutex);
+    pthread_join(st->worker, NULL);
+
+    pthread_mutex_destroy(&st->mutex);
+    pthread_cond_destroy(&st->cond);
+
+    nrsc5_conv_free(st->vdec_p1);
+    nrsc5_conv_free(st->vdec_pids);
+    nrsc5_conv_free(st->vdec_p3);
 }
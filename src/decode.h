@@ -1,59 +1,92 @@
 #pragma once
 
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include "defines.h"
 #include "pids.h"
 
+// number of P1 interleaver buffers (one being filled, the rest queued for decoding)
+#define DECODE_PM_BUFFERS 2
+
+struct vdecoder;
+
 typedef struct
 {
     struct input_t *input;
-    int8_t buffer_pm[720 * BLKSZ * 16];
+    int8_t buffer_pm[DECODE_PM_BUFFERS][720 * BLKSZ * 16];
     unsigned int idx_pm;
+    unsigned int pm_fill;
+    unsigned int pm_queued;
+    unsigned int pm_dropped;
+    // report the channel BER of every Nth P1 frame, 0 to disable; set by
+    // the application while the P1 decode thread reads it
+    atomic_uint ber_interval;
+    unsigned int ber_count;
     int8_t buffer_px1[144 * BLKSZ * 2];
     unsigned int idx_px1;
 
-    int8_t viterbi_p1[P1_FRAME_LEN * 3];
-    uint8_t scrambler_p1[P1_FRAME_LEN];
-    int8_t viterbi_pids[PIDS_FRAME_LEN * 3];
-    uint8_t scrambler_pids[PIDS_FRAME_LEN];
+    int8_t viterbi_p1[P1_FRAME_LEN_ENCODED];
+    uint8_t scrambler_p1[P1_FRAME_LEN / 8];
+    int8_t viterbi_pids[PIDS_FRAME_LEN_ENCODED];
+    uint8_t scrambler_pids[PIDS_FRAME_LEN / 8];
     int8_t internal_p3[P3_FRAME_LEN * 32];
     unsigned int i_p3;
     int ready_p3;
-    unsigned int pt_p3[4];
-    int8_t viterbi_p3[P3_FRAME_LEN * 3];
-    uint8_t scrambler_p3[P3_FRAME_LEN];
+    int8_t viterbi_p3[P3_FRAME_LEN_ENCODED];
+    uint8_t scrambler_p3[P3_FRAME_LEN / 8];
+
+    struct vdecoder *vdec_p1;
+    struct vdecoder *vdec_pids;
+    struct vdecoder *vdec_p3;
 
     pids_t pids;
+
+    pthread_t worker;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int worker_busy;
+    int worker_closed;
 } decode_t;
 
-void decode_process_p1(decode_t *st);
+void decode_queue_p1(decode_t *st);
 void decode_process_pids(decode_t *st);
 void decode_process_p3(decode_t *st);
 static inline unsigned int decode_get_block(decode_t *st)
 {
     return st->idx_pm / (720 * BLKSZ);
 }
-static inline void decode_push_pm(decode_t *st, int8_t sbit)
+// soft bits for the next L1 block, 720 per symbol
+static inline int8_t *decode_get_pm_block(decode_t *st)
 {
-    st->buffer_pm[st->idx_pm++] = sbit;
-    if (st->idx_pm % (720 * BLKSZ) == 0)
-    {
-        decode_process_pids(st);
-    }
+    return &st->buffer_pm[st->pm_fill][st->idx_pm];
+}
+static inline void decode_push_pm_block(decode_t *st)
+{
+    st->idx_pm += 720 * BLKSZ;
+    decode_process_pids(st);
     if (st->idx_pm == 720 * BLKSZ * 16)
     {
-        decode_process_p1(st);
+        decode_queue_p1(st);
         st->idx_pm = 0;
     }
 }
-static inline void decode_push_px1(decode_t *st, int8_t sbit)
+// soft bits for the next L1 block, 144 per symbol
+static inline int8_t *decode_get_px1_block(decode_t *st)
+{
+    return &st->buffer_px1[st->idx_px1];
+}
+static inline void decode_push_px1_block(decode_t *st)
 {
-    st->buffer_px1[st->idx_px1++] = sbit;
-    if (st->idx_px1 % (144 * BLKSZ * 2) == 0)
+    st->idx_px1 += 144 * BLKSZ;
+    if (st->idx_px1 == 144 * BLKSZ * 2)
     {
         decode_process_p3(st);
         st->idx_px1 = 0;
     }
 }
 void decode_reset(decode_t *st);
-void decode_init(decode_t *st, struct input_t *input);
+void decode_wait(decode_t *st);
+unsigned int decode_get_dropped(decode_t *st);
+int decode_init(decode_t *st, struct input_t *input);
+void decode_free(decode_t *st);
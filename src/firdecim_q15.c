@@ -2,6 +2,7 @@
 
 #include <assert.h>
 #include <stdint.h>
+#include <string.h>
 
 #ifdef HAVE_NEON
 #include <arm_neon.h>
@@ -11,17 +12,58 @@
 #include <emmintrin.h>
 #endif
 
+#ifdef HAVE_AVX2_DISPATCH
+#include <immintrin.h>
+#endif
+
 #include "firdecim_q15.h"
 
 #define WINDOW_SIZE 2048
+// output samples produced per iteration of firdecim_q15_execute_block
+#define BLOCK_SIZE 2048
+// even and odd input samples kept from the previous block
+#define HALFBAND_HISTORY 7
+
+typedef void (*fir_block_t)(const cint16_t *a, const int16_t *taps, unsigned int count, cint16_t *y);
+typedef void (*halfband_block_t)(const cint16_t *even, const cint16_t *odd, const int16_t *taps, unsigned int count, cint16_t *y);
 
 struct firdecim_q15 {
     int16_t * taps;
     unsigned int ntaps;
     cint16_t * window;
     unsigned int idx;
+
+    // even and odd input samples for block processing
+    cint16_t * even;
+    cint16_t * odd;
+    fir_block_t fir_block;
+    halfband_block_t halfband_block;
 };
 
+#if defined(HAVE_SSE2) || !defined(HAVE_NEON)
+static void fir_block_generic(const cint16_t *a, const int16_t *taps, unsigned int count, cint16_t *y);
+#endif
+#ifdef HAVE_SSE2
+static void fir_block_sse2(const cint16_t *a, const int16_t *taps, unsigned int count, cint16_t *y);
+#endif
+#ifdef HAVE_NEON
+static void fir_block_neon(const cint16_t *a, const int16_t *taps, unsigned int count, cint16_t *y);
+#endif
+#ifdef HAVE_AVX2_DISPATCH
+static void fir_block_avx2(const cint16_t *a, const int16_t *taps, unsigned int count, cint16_t *y);
+#endif
+
+static void halfband_block_generic(const cint16_t *even, const cint16_t *odd, const int16_t *taps, unsigned int count, cint16_t *y);
+#ifdef HAVE_SSE2
+static void halfband_block_sse2(const cint16_t *even, const cint16_t *odd, const int16_t *taps, unsigned int count, cint16_t *y);
+#endif
+#ifdef HAVE_NEON
+static void halfband_block_neon(const cint16_t *even, const cint16_t *odd, const int16_t *taps, unsigned int count, cint16_t *y);
+#endif
+#ifdef HAVE_AVX2_DISPATCH
+static void halfband_block_avx2(const cint16_t *even, const cint16_t *odd, const int16_t *taps, unsigned int count, cint16_t *y);
+#endif
+
 firdecim_q15 firdecim_q15_create(const float * taps, unsigned int ntaps)
 {
     firdecim_q15 q;
@@ -30,8 +72,29 @@ firdecim_q15 firdecim_q15_create(const float * taps, unsigned int ntaps)
     q->ntaps = (ntaps == 32) ? 32 : 15;
     q->taps = malloc(sizeof(int16_t) * ntaps * 2);
     q->window = calloc(sizeof(cint16_t), WINDOW_SIZE);
+    q->even = malloc(sizeof(cint16_t) * (HALFBAND_HISTORY + BLOCK_SIZE));
+    q->odd = malloc(sizeof(cint16_t) * (HALFBAND_HISTORY + BLOCK_SIZE));
     firdecim_q15_reset(q);
 
+#if defined(HAVE_SSE2)
+    q->fir_block = fir_block_sse2;
+    q->halfband_block = halfband_block_sse2;
+#elif defined(HAVE_NEON)
+    q->fir_block = fir_block_neon;
+    q->halfband_block = halfband_block_neon;
+#else
+    q->fir_block = fir_block_generic;
+    q->halfband_block = halfband_block_generic;
+#endif
+#ifdef HAVE_AVX2_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        q->fir_block = fir_block_avx2;
+        q->halfband_block = halfband_block_avx2;
+    }
+#endif
+
     // reverse order so we can push into the window
     // duplicate for neon
     for (unsigned int i = 0; i < ntaps; ++i)
@@ -47,6 +110,8 @@ void firdecim_q15_free(firdecim_q15 q)
 {
     free(q->taps);
     free(q->window);
+    free(q->even);
+    free(q->odd);
     free(q);
 }
 
@@ -55,30 +120,33 @@ void firdecim_q15_reset(firdecim_q15 q)
     q->idx = q->ntaps - 1;
 }
 
+static void shift_window(firdecim_q15 q)
+{
+    for (unsigned int i = 0; i < q->ntaps - 1; i++)
+        q->window[i] = q->window[q->idx - q->ntaps + 1 + i];
+    q->idx = q->ntaps - 1;
+}
+
 static void push(firdecim_q15 q, cint16_t x)
 {
     if (q->idx == WINDOW_SIZE)
-    {
-        for (unsigned int i = 0; i < q->ntaps - 1; i++)
-            q->window[i] = q->window[q->idx - q->ntaps + 1 + i];
-        q->idx = q->ntaps - 1;
-    }
+        shift_window(q);
     q->window[q->idx++] = x;
 }
 
 #ifdef HAVE_NEON
-static cint16_t dotprod_32(cint16_t *a, int16_t *b)
+static cint16_t dotprod_32(const cint16_t *a, const int16_t *b)
 {
-    int16x8_t s1 = vqdmulhq_s16(vld1q_s16((int16_t *)&a[0]), vld1q_s16(&b[0*2]));
-    int16x8_t s2 = vqdmulhq_s16(vld1q_s16((int16_t *)&a[4]), vld1q_s16(&b[4*2]));
-    int16x8_t s3 = vqdmulhq_s16(vld1q_s16((int16_t *)&a[8]), vld1q_s16(&b[8*2]));
-    int16x8_t s4 = vqdmulhq_s16(vld1q_s16((int16_t *)&a[12]), vld1q_s16(&b[12*2]));
+    int16x8_t s1 = vqdmulhq_s16(vld1q_s16((const int16_t *)&a[0]), vld1q_s16(&b[0*2]));
+    int16x8_t s2 = vqdmulhq_s16(vld1q_s16((const int16_t *)&a[4]), vld1q_s16(&b[4*2]));
+    int16x8_t s3 = vqdmulhq_s16(vld1q_s16((const int16_t *)&a[8]), vld1q_s16(&b[8*2]));
+    int16x8_t s4 = vqdmulhq_s16(vld1q_s16((const int16_t *)&a[12]), vld1q_s16(&b[12*2]));
     int16x8_t sum = vqaddq_s16(vqaddq_s16(s1, s2), vqaddq_s16(s3, s4));
 
-    s1 = vqdmulhq_s16(vld1q_s16((int16_t *)&a[16]), vld1q_s16(&b[16*2]));
-    s2 = vqdmulhq_s16(vld1q_s16((int16_t *)&a[20]), vld1q_s16(&b[20*2]));
-    s3 = vqdmulhq_s16(vld1q_s16((int16_t *)&a[24]), vld1q_s16(&b[24*2]));
-    s4 = vqdmulhq_s16(vld1q_s16((int16_t *)&a[28]), vld1q_s16(&b[28*2]));
+    s1 = vqdmulhq_s16(vld1q_s16((const int16_t *)&a[16]), vld1q_s16(&b[16*2]));
+    s2 = vqdmulhq_s16(vld1q_s16((const int16_t *)&a[20]), vld1q_s16(&b[20*2]));
+    s3 = vqdmulhq_s16(vld1q_s16((const int16_t *)&a[24]), vld1q_s16(&b[24*2]));
+    s4 = vqdmulhq_s16(vld1q_s16((const int16_t *)&a[28]), vld1q_s16(&b[28*2]));
     sum = vqaddq_s16(vqaddq_s16(s1, s2), sum);
     sum = vqaddq_s16(vqaddq_s16(s3, s4), sum);
 
@@ -92,7 +160,7 @@ static cint16_t dotprod_32(cint16_t *a, int16_t *b)
     return result[0];
 }
 #else
-static cint16_t dotprod_32(cint16_t *a, int16_t *b)
+static cint16_t dotprod_32(const cint16_t *a, const int16_t *b)
 {
     cint16_t sum = { 0 };
     int i;
@@ -163,3 +231,340 @@ void halfband_q15_execute(firdecim_q15 q, const cint16_t *x, cint16_t *y)
     *y = dotprod_halfband_4(&q->window[q->idx - q->ntaps], q->taps);
     push(q, x[1]);
 }
+
+/*
+ * Block filtering
+ *
+ * Computes consecutive outputs of the symmetric 32 tap filter at once,
+ * using the same arithmetic as the scalar dotprod_32: each pair of samples
+ * is multiplied by its tap at full precision, truncated to Q15, and the
+ * results are summed with 16-bit wraparound. The NEON kernel follows the
+ * saturating arithmetic of the NEON dotprod_32 instead.
+ */
+#if defined(HAVE_SSE2) || !defined(HAVE_NEON)
+static void fir_block_generic(const cint16_t *a, const int16_t *taps, unsigned int count, cint16_t *y)
+{
+    for (unsigned int k = 0; k < count; k++)
+    {
+        cint16_t sum = { 0 };
+        int i;
+
+        for (i = 1; i < 16; i++)
+        {
+            sum.r += ((a[k + i].r + a[k + 32 - i].r) * taps[i * 2]) >> 15;
+            sum.i += ((a[k + i].i + a[k + 32 - i].i) * taps[i * 2]) >> 15;
+        }
+        sum.r += (a[k + i].r * taps[i * 2]) >> 15;
+        sum.i += (a[k + i].i * taps[i * 2]) >> 15;
+
+        y[k] = sum;
+    }
+}
+#endif
+
+#ifdef HAVE_SSE2
+static void fir_block_sse2(const cint16_t *a, const int16_t *taps, unsigned int count, cint16_t *y)
+{
+    unsigned int k;
+
+    for (k = 0; k + 4 <= count; k += 4)
+    {
+        __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+
+        for (int i = 1; i <= 16; i++)
+        {
+            __m128i x0 = _mm_loadu_si128((const __m128i *) &a[k + i]);
+            __m128i x1 = i < 16 ? _mm_loadu_si128((const __m128i *) &a[k + 32 - i]) : _mm_setzero_si128();
+            __m128i t = _mm_set1_epi16(taps[i * 2]);
+
+            // x0 * t + x1 * t for outputs k, k+1 (lo) and k+2, k+3 (hi)
+            lo = _mm_add_epi32(lo, _mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(x0, x1), t), 15));
+            hi = _mm_add_epi32(hi, _mm_srai_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(x0, x1), t), 15));
+        }
+
+        // wrap to 16 bits, so that packing does not saturate
+        lo = _mm_srai_epi32(_mm_slli_epi32(lo, 16), 16);
+        hi = _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16);
+        _mm_storeu_si128((__m128i *) &y[k], _mm_packs_epi32(lo, hi));
+    }
+
+    fir_block_generic(&a[k], taps, count - k, &y[k]);
+}
+#endif
+
+#ifdef HAVE_NEON
+/*
+ * The NEON dotprod_32 multiplies each sample by its own tap with
+ * vqdmulhq_s16 and sums with saturation, so this repeats its operations
+ * in the same order for four outputs at a time.
+ */
+static void fir_block_neon(const cint16_t *a, const int16_t *taps, unsigned int count, cint16_t *y)
+{
+    unsigned int k;
+
+    for (k = 0; k + 4 <= count; k += 4)
+    {
+        int16x8_t out = vdupq_n_s16(0);
+
+        // lane j of dotprod_32 holds the products of taps j, j + 4, ..., j + 28
+        for (int j = 0; j < 4; j++)
+        {
+            int16x8_t p[8];
+
+            for (int g = 0; g < 8; g++)
+                p[g] = vqdmulhq_s16(vld1q_s16((const int16_t *) &a[k + g * 4 + j]), vdupq_n_s16(taps[(g * 4 + j) * 2]));
+
+            int16x8_t sum = vqaddq_s16(vqaddq_s16(p[0], p[1]), vqaddq_s16(p[2], p[3]));
+            sum = vqaddq_s16(vqaddq_s16(p[4], p[5]), sum);
+            sum = vqaddq_s16(vqaddq_s16(p[6], p[7]), sum);
+
+            // the lanes are added without saturation
+            out = vaddq_s16(out, sum);
+        }
+
+        vst1q_s16((int16_t *) &y[k], out);
+    }
+
+    for (; k < count; k++)
+        y[k] = dotprod_32(&a[k], taps);
+}
+#endif
+
+#ifdef HAVE_AVX2_DISPATCH
+__attribute__((target("avx2")))
+static void fir_block_avx2(const cint16_t *a, const int16_t *taps, unsigned int count, cint16_t *y)
+{
+    unsigned int k;
+
+    for (k = 0; k + 8 <= count; k += 8)
+    {
+        __m256i lo = _mm256_setzero_si256(), hi = _mm256_setzero_si256();
+
+        for (int i = 1; i <= 16; i++)
+        {
+            __m256i x0 = _mm256_loadu_si256((const __m256i *) &a[k + i]);
+            __m256i x1 = i < 16 ? _mm256_loadu_si256((const __m256i *) &a[k + 32 - i]) : _mm256_setzero_si256();
+            __m256i t = _mm256_set1_epi16(taps[i * 2]);
+
+            // unpack and pack operate within 128-bit lanes, so the output order is preserved
+            lo = _mm256_add_epi32(lo, _mm256_srai_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(x0, x1), t), 15));
+            hi = _mm256_add_epi32(hi, _mm256_srai_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(x0, x1), t), 15));
+        }
+
+        lo = _mm256_srai_epi32(_mm256_slli_epi32(lo, 16), 16);
+        hi = _mm256_srai_epi32(_mm256_slli_epi32(hi, 16), 16);
+        _mm256_storeu_si256((__m256i *) &y[k], _mm256_packs_epi32(lo, hi));
+    }
+
+    fir_block_generic(&a[k], taps, count - k, &y[k]);
+}
+#endif
+
+/*
+ * Filter a block of samples with the 32 tap filter. Equivalent to calling
+ * fir_q15_execute for each sample.
+ */
+void fir_q15_execute_block(firdecim_q15 q, const cint16_t *x, unsigned int len, cint16_t *y)
+{
+    assert(q->ntaps == 32);
+
+    while (len > 0)
+    {
+        unsigned int count;
+
+        if (q->idx == WINDOW_SIZE)
+            shift_window(q);
+
+        count = WINDOW_SIZE - q->idx < len ? WINDOW_SIZE - q->idx : len;
+        memcpy(&q->window[q->idx], x, sizeof(cint16_t) * count);
+        q->fir_block(&q->window[q->idx + 1 - q->ntaps], q->taps, count, y);
+
+        q->idx += count;
+        x += count;
+        y += count;
+        len -= count;
+    }
+}
+
+/*
+ * Block halfband decimation
+ *
+ * The halfband filter only has non-zero taps at even distances from its
+ * center, so each output is the sum of four pairs of even input samples
+ * and a single odd input sample. With the input split into even and odd
+ * samples, consecutive outputs read consecutive samples, and several
+ * outputs are computed at once. For output p:
+ *
+ *   y[p] = odd[p + 3] + sum(taps[j] * (even[p + j] + even[p + 7 - j]))
+ *
+ * where even and odd start with HALFBAND_HISTORY samples from the previous
+ * block. Products are truncated to Q15 and summed with 16-bit wraparound,
+ * exactly as in the scalar halfband_q15_execute.
+ */
+static void halfband_block_generic(const cint16_t *even, const cint16_t *odd, const int16_t *taps, unsigned int count, cint16_t *y)
+{
+    for (unsigned int p = 0; p < count; p++)
+    {
+        cint16_t sum = odd[p + 3];
+
+        for (int j = 0; j < 4; j++)
+        {
+            sum.r += ((even[p + j].r + even[p + 7 - j].r) * taps[j * 2]) >> 15;
+            sum.i += ((even[p + j].i + even[p + 7 - j].i) * taps[j * 2]) >> 15;
+        }
+        y[p] = sum;
+    }
+}
+
+#ifdef HAVE_SSE2
+// low 16 bits of (a * b) >> 15
+static inline __m128i mul_q15_sse2(__m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_slli_epi16(_mm_mulhi_epi16(a, b), 1),
+                        _mm_srli_epi16(_mm_mullo_epi16(a, b), 15));
+}
+
+static void halfband_block_sse2(const cint16_t *even, const cint16_t *odd, const int16_t *taps, unsigned int count, cint16_t *y)
+{
+    unsigned int p;
+
+    for (p = 0; p + 4 <= count; p += 4)
+    {
+        __m128i sum = _mm_loadu_si128((const __m128i *) &odd[p + 3]);
+
+        for (int j = 0; j < 4; j++)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i *) &even[p + j]);
+            __m128i b = _mm_loadu_si128((const __m128i *) &even[p + 7 - j]);
+            sum = _mm_add_epi16(sum, mul_q15_sse2(_mm_add_epi16(a, b), _mm_set1_epi16(taps[j * 2])));
+        }
+        _mm_storeu_si128((__m128i *) &y[p], sum);
+    }
+
+    halfband_block_generic(&even[p], &odd[p], taps, count - p, &y[p]);
+}
+#endif
+
+#ifdef HAVE_NEON
+static void halfband_block_neon(const cint16_t *even, const cint16_t *odd, const int16_t *taps, unsigned int count, cint16_t *y)
+{
+    unsigned int p;
+
+    for (p = 0; p + 4 <= count; p += 4)
+    {
+        int16x8_t sum = vld1q_s16((const int16_t *) &odd[p + 3]);
+
+        for (int j = 0; j < 4; j++)
+        {
+            int16x8_t a = vaddq_s16(vld1q_s16((const int16_t *) &even[p + j]),
+                                    vld1q_s16((const int16_t *) &even[p + 7 - j]));
+            int16x4_t t = vdup_n_s16(taps[j * 2]);
+            int16x8_t prod = vcombine_s16(vshrn_n_s32(vmull_s16(vget_low_s16(a), t), 15),
+                                          vshrn_n_s32(vmull_s16(vget_high_s16(a), t), 15));
+            sum = vaddq_s16(sum, prod);
+        }
+        vst1q_s16((int16_t *) &y[p], sum);
+    }
+
+    halfband_block_generic(&even[p], &odd[p], taps, count - p, &y[p]);
+}
+#endif
+
+#ifdef HAVE_AVX2_DISPATCH
+__attribute__((target("avx2")))
+static void halfband_block_avx2(const cint16_t *even, const cint16_t *odd, const int16_t *taps, unsigned int count, cint16_t *y)
+{
+    unsigned int p;
+
+    for (p = 0; p + 8 <= count; p += 8)
+    {
+        __m256i sum = _mm256_loadu_si256((const __m256i *) &odd[p + 3]);
+
+        for (int j = 0; j < 4; j++)
+        {
+            __m256i a = _mm256_add_epi16(_mm256_loadu_si256((const __m256i *) &even[p + j]),
+                                         _mm256_loadu_si256((const __m256i *) &even[p + 7 - j]));
+            __m256i t = _mm256_set1_epi16(taps[j * 2]);
+            __m256i prod = _mm256_or_si256(_mm256_slli_epi16(_mm256_mulhi_epi16(a, t), 1),
+                                           _mm256_srli_epi16(_mm256_mullo_epi16(a, t), 15));
+            sum = _mm256_add_epi16(sum, prod);
+        }
+        _mm256_storeu_si256((__m256i *) &y[p], sum);
+    }
+
+    halfband_block_generic(&even[p], &odd[p], taps, count - p, &y[p]);
+}
+#endif
+
+// split cu8 samples into even and odd Q15 samples
+static void convert_cu8(const uint8_t *x, unsigned int count, cint16_t *even, cint16_t *odd)
+{
+    unsigned int p = 0;
+
+#ifdef HAVE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set1_epi16(127);
+
+    for (; p + 4 <= count; p += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *) &x[p * 4]);
+        __m128i lo = _mm_slli_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(v, zero), bias), 6);
+        __m128i hi = _mm_slli_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(v, zero), bias), 6);
+
+        // order as even, even, odd, odd
+        lo = _mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 1, 2, 0));
+        hi = _mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128((__m128i *) &even[p], _mm_unpacklo_epi64(lo, hi));
+        _mm_storeu_si128((__m128i *) &odd[p], _mm_unpackhi_epi64(lo, hi));
+    }
+#endif
+
+    for (; p < count; p++)
+    {
+        even[p].r = U8_Q15(x[p * 4]);
+        even[p].i = U8_Q15(x[p * 4 + 1]);
+        odd[p].r = U8_Q15(x[p * 4 + 2]);
+        odd[p].i = U8_Q15(x[p * 4 + 3]);
+    }
+}
+
+/*
+ * Convert and decimate a buffer of cu8 samples (len bytes) with the
+ * halfband filter. Equivalent to calling halfband_q15_execute for each
+ * pair of samples. Returns the number of output samples.
+ */
+unsigned int firdecim_q15_execute_block(firdecim_q15 q, const uint8_t *x, unsigned int len, cint16_t *y)
+{
+    unsigned int total = len / 4;
+
+    assert(q->ntaps == 15);
+    assert(len % 4 == 0);
+
+    // take the history from the window, so that both interfaces can be mixed
+    for (unsigned int i = 0; i < HALFBAND_HISTORY; i++)
+    {
+        q->even[i] = q->window[q->idx - 14 + i * 2];
+        q->odd[i] = q->window[q->idx - 13 + i * 2];
+    }
+
+    for (unsigned int done = 0; done < total; )
+    {
+        unsigned int count = total - done < BLOCK_SIZE ? total - done : BLOCK_SIZE;
+
+        convert_cu8(&x[done * 4], count, &q->even[HALFBAND_HISTORY], &q->odd[HALFBAND_HISTORY]);
+        q->halfband_block(q->even, q->odd, q->taps, count, &y[done]);
+
+        memmove(&q->even[0], &q->even[count], sizeof(cint16_t) * HALFBAND_HISTORY);
+        memmove(&q->odd[0], &q->odd[count], sizeof(cint16_t) * HALFBAND_HISTORY);
+        done += count;
+    }
+
+    for (unsigned int i = 0; i < HALFBAND_HISTORY; i++)
+    {
+        q->window[i * 2] = q->even[i];
+        q->window[i * 2 + 1] = q->odd[i];
+    }
+    q->idx = 14;
+
+    return total;
+}
@@ -8,4 +8,6 @@ firdecim_q15 firdecim_q15_create(const float * taps, unsigned int ntaps);
 void firdecim_q15_free(firdecim_q15);
 void firdecim_q15_reset(firdecim_q15);
 void fir_q15_execute(firdecim_q15 q, const cint16_t *x, cint16_t *y);
+void fir_q15_execute_block(firdecim_q15 q, const cint16_t *x, unsigned int len, cint16_t *y);
 void halfband_q15_execute(firdecim_q15 q, const cint16_t *x, cint16_t *y);
+unsigned int firdecim_q15_execute_block(firdecim_q15 q, const uint8_t *x, unsigned int len, cint16_t *y);
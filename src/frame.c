@@ -15,6 +15,7 @@
 
 #include <string.h>
 
+#include "crc.h"
 #include "defines.h"
 #include "frame.h"
 #include "input.h"
@@ -54,92 +55,9 @@ typedef struct
     unsigned int pdu_marker;
 } hef_t;
 
-static const uint8_t crc8_tab[] = {
-    0, 0x31, 0x62, 0x53, 0xC4, 0xF5, 0xA6, 0x97, 0xB9,
-    0x88, 0xDB, 0xEA, 0x7D, 0x4C, 0x1F, 0x2E, 0x43, 0x72,
-    0x21, 0x10, 0x87, 0xB6, 0xE5, 0xD4, 0xFA, 0xCB, 0x98,
-    0xA9, 0x3E, 0xF, 0x5C, 0x6D, 0x86, 0xB7, 0xE4, 0xD5,
-    0x42, 0x73, 0x20, 0x11, 0x3F, 0xE, 0x5D, 0x6C, 0xFB,
-    0xCA, 0x99, 0xA8, 0xC5, 0xF4, 0xA7, 0x96, 1, 0x30,
-    0x63, 0x52, 0x7C, 0x4D, 0x1E, 0x2F, 0xB8, 0x89, 0xDA,
-    0xEB, 0x3D, 0xC, 0x5F, 0x6E, 0xF9, 0xC8, 0x9B, 0xAA,
-    0x84, 0xB5, 0xE6, 0xD7, 0x40, 0x71, 0x22, 0x13, 0x7E,
-    0x4F, 0x1C, 0x2D, 0xBA, 0x8B, 0xD8, 0xE9, 0xC7, 0xF6,
-    0xA5, 0x94, 3, 0x32, 0x61, 0x50, 0xBB, 0x8A, 0xD9,
-    0xE8, 0x7F, 0x4E, 0x1D, 0x2C, 2, 0x33, 0x60, 0x51,
-    0xC6, 0xF7, 0xA4, 0x95, 0xF8, 0xC9, 0x9A, 0xAB, 0x3C,
-    0xD, 0x5E, 0x6F, 0x41, 0x70, 0x23, 0x12, 0x85, 0xB4,
-    0xE7, 0xD6, 0x7A, 0x4B, 0x18, 0x29, 0xBE, 0x8F, 0xDC,
-    0xED, 0xC3, 0xF2, 0xA1, 0x90, 7, 0x36, 0x65, 0x54,
-    0x39, 8, 0x5B, 0x6A, 0xFD, 0xCC, 0x9F, 0xAE, 0x80,
-    0xB1, 0xE2, 0xD3, 0x44, 0x75, 0x26, 0x17, 0xFC, 0xCD,
-    0x9E, 0xAF, 0x38, 9, 0x5A, 0x6B, 0x45, 0x74, 0x27,
-    0x16, 0x81, 0xB0, 0xE3, 0xD2, 0xBF, 0x8E, 0xDD, 0xEC,
-    0x7B, 0x4A, 0x19, 0x28, 6, 0x37, 0x64, 0x55, 0xC2,
-    0xF3, 0xA0, 0x91, 0x47, 0x76, 0x25, 0x14, 0x83, 0xB2,
-    0xE1, 0xD0, 0xFE, 0xCF, 0x9C, 0xAD, 0x3A, 0xB, 0x58,
-    0x69, 4, 0x35, 0x66, 0x57, 0xC0, 0xF1, 0xA2, 0x93,
-    0xBD, 0x8C, 0xDF, 0xEE, 0x79, 0x48, 0x1B, 0x2A, 0xC1,
-    0xF0, 0xA3, 0x92, 5, 0x34, 0x67, 0x56, 0x78, 0x49,
-    0x1A, 0x2B, 0xBC, 0x8D, 0xDE, 0xEF, 0x82, 0xB3, 0xE0,
-    0xD1, 0x46, 0x77, 0x24, 0x15, 0x3B, 0xA, 0x59, 0x68,
-    0xFF, 0xCE, 0x9D, 0xAC
-};
-
-static const uint16_t fcs_tab[] = {
-    0x0000, 0x1189, 0x2312, 0x329b, 0x4624, 0x57ad, 0x6536, 0x74bf,
-    0x8c48, 0x9dc1, 0xaf5a, 0xbed3, 0xca6c, 0xdbe5, 0xe97e, 0xf8f7,
-    0x1081, 0x0108, 0x3393, 0x221a, 0x56a5, 0x472c, 0x75b7, 0x643e,
-    0x9cc9, 0x8d40, 0xbfdb, 0xae52, 0xdaed, 0xcb64, 0xf9ff, 0xe876,
-    0x2102, 0x308b, 0x0210, 0x1399, 0x6726, 0x76af, 0x4434, 0x55bd,
-    0xad4a, 0xbcc3, 0x8e58, 0x9fd1, 0xeb6e, 0xfae7, 0xc87c, 0xd9f5,
-    0x3183, 0x200a, 0x1291, 0x0318, 0x77a7, 0x662e, 0x54b5, 0x453c,
-    0xbdcb, 0xac42, 0x9ed9, 0x8f50, 0xfbef, 0xea66, 0xd8fd, 0xc974,
-    0x4204, 0x538d, 0x6116, 0x709f, 0x0420, 0x15a9, 0x2732, 0x36bb,
-    0xce4c, 0xdfc5, 0xed5e, 0xfcd7, 0x8868, 0x99e1, 0xab7a, 0xbaf3,
-    0x5285, 0x430c, 0x7197, 0x601e, 0x14a1, 0x0528, 0x37b3, 0x263a,
-    0xdecd, 0xcf44, 0xfddf, 0xec56, 0x98e9, 0x8960, 0xbbfb, 0xaa72,
-    0x6306, 0x728f, 0x4014, 0x519d, 0x2522, 0x34ab, 0x0630, 0x17b9,
-    0xef4e, 0xfec7, 0xcc5c, 0xddd5, 0xa96a, 0xb8e3, 0x8a78, 0x9bf1,
-    0x7387, 0x620e, 0x5095, 0x411c, 0x35a3, 0x242a, 0x16b1, 0x0738,
-    0xffcf, 0xee46, 0xdcdd, 0xcd54, 0xb9eb, 0xa862, 0x9af9, 0x8b70,
-    0x8408, 0x9581, 0xa71a, 0xb693, 0xc22c, 0xd3a5, 0xe13e, 0xf0b7,
-    0x0840, 0x19c9, 0x2b52, 0x3adb, 0x4e64, 0x5fed, 0x6d76, 0x7cff,
-    0x9489, 0x8500, 0xb79b, 0xa612, 0xd2ad, 0xc324, 0xf1bf, 0xe036,
-    0x18c1, 0x0948, 0x3bd3, 0x2a5a, 0x5ee5, 0x4f6c, 0x7df7, 0x6c7e,
-    0xa50a, 0xb483, 0x8618, 0x9791, 0xe32e, 0xf2a7, 0xc03c, 0xd1b5,
-    0x2942, 0x38cb, 0x0a50, 0x1bd9, 0x6f66, 0x7eef, 0x4c74, 0x5dfd,
-    0xb58b, 0xa402, 0x9699, 0x8710, 0xf3af, 0xe226, 0xd0bd, 0xc134,
-    0x39c3, 0x284a, 0x1ad1, 0x0b58, 0x7fe7, 0x6e6e, 0x5cf5, 0x4d7c,
-    0xc60c, 0xd785, 0xe51e, 0xf497, 0x8028, 0x91a1, 0xa33a, 0xb2b3,
-    0x4a44, 0x5bcd, 0x6956, 0x78df, 0x0c60, 0x1de9, 0x2f72, 0x3efb,
-    0xd68d, 0xc704, 0xf59f, 0xe416, 0x90a9, 0x8120, 0xb3bb, 0xa232,
-    0x5ac5, 0x4b4c, 0x79d7, 0x685e, 0x1ce1, 0x0d68, 0x3ff3, 0x2e7a,
-    0xe70e, 0xf687, 0xc41c, 0xd595, 0xa12a, 0xb0a3, 0x8238, 0x93b1,
-    0x6b46, 0x7acf, 0x4854, 0x59dd, 0x2d62, 0x3ceb, 0x0e70, 0x1ff9,
-    0xf78f, 0xe606, 0xd49d, 0xc514, 0xb1ab, 0xa022, 0x92b9, 0x8330,
-    0x7bc7, 0x6a4e, 0x58d5, 0x495c, 0x3de3, 0x2c6a, 0x1ef1, 0x0f78
-};
-
 /* Good final FCS value */
 #define VALIDFCS16 0xf0b8
 
-static uint8_t crc8(const uint8_t *pkt, unsigned int cnt)
-{
-    unsigned int i, crc = 0xFF;
-    for (i = 0; i < cnt; ++i)
-        crc = crc8_tab[crc ^ pkt[i]];
-    return crc;
-}
-
-static uint16_t fcs16(const uint8_t *cp, int len)
-{
-    uint16_t crc = 0xFFFF;
-    while (len--)
-        crc = (crc >> 8) ^ fcs_tab[(crc ^ *cp++) & 0xFF];
-    return (crc);
-}
-
 static int has_fixed(frame_t *st)
 {
     return st->pci == PCI_AUDIO_FIXED || st->pci == PCI_AUDIO_FIXED_OPP;
@@ -147,27 +65,24 @@ static int has_fixed(frame_t *st)
 
 static int fix_header(frame_t *st, uint8_t *buf)
 {
-    uint8_t hdr[RS_BLOCK_LEN];
+    uint8_t hdr[RS_CODEWORD_LEN];
     int i, corrections;
 
-    memset(hdr, 0, RS_BLOCK_LEN-RS_CODEWORD_LEN);
+    // the codeword is shortened, and transmitted in reverse order
     for (i = 0; i < RS_CODEWORD_LEN; i++)
-        hdr[RS_BLOCK_LEN-i-1] = buf[i];
+        hdr[RS_CODEWORD_LEN-i-1] = buf[i];
 
     corrections = decode_rs_char(st->rs_dec, hdr, NULL, 0);
 
     if (corrections == -1)
         return 0;
 
-    for (i = 0; i < RS_BLOCK_LEN-RS_CODEWORD_LEN; i++)
-        if (hdr[i] != 0)
-            return 0;
-
     if (corrections > 0)
+    {
         log_debug("RS corrected %d symbols", corrections);
-
-    for (i = 0; i < RS_CODEWORD_LEN; i++)
-        buf[i] = hdr[RS_BLOCK_LEN-i-1];
+        for (i = 0; i < RS_CODEWORD_LEN; i++)
+            buf[i] = hdr[RS_CODEWORD_LEN-i-1];
+    }
     return 1;
 }
 
@@ -292,25 +207,8 @@ static unsigned int parse_location(uint8_t *buf, unsigned int lc_bits, unsigned
     }
 }
 
-static int unescape_hdlc(uint8_t *data, int length)
-{
-    uint8_t *p = data;
-
-    for (int i = 0; i < length; i++)
-    {
-        if (data[i] == 0x7D)
-            *p++ = data[++i] | 0x20;
-        else
-            *p++ = data[i];
-    }
-
-    return p - data;
-}
-
 static void aas_push(frame_t *st, uint8_t* psd, unsigned int length)
 {
-    length = unescape_hdlc(psd, length);
-
     if (length == 0)
     {
         // empty frames are used as padding
@@ -330,34 +228,73 @@ static void aas_push(frame_t *st, uint8_t* psd, unsigned int length)
     }
 }
 
-static void parse_hdlc(frame_t *st, void (*process)(frame_t *, uint8_t *, unsigned int), uint8_t *buffer, int *bufidx, int bufsz, uint8_t *input, size_t inlen)
+// append bytes to the frame being buffered, removing escapes
+static void append_hdlc(hdlc_t *hdlc, uint8_t *buffer, int bufsz, const uint8_t *input, size_t inlen)
 {
-    for (size_t i = 0; i < inlen; i++)
+    while (inlen > 0 && hdlc->idx >= 0)
     {
-        uint8_t byte = input[i];
-        if (byte == 0x7E)
+        const uint8_t *src = input;
+        uint8_t escaped;
+        size_t run, skip;
+
+        if (hdlc->escape)
         {
-            if (*bufidx >= 0)
-                process(st, buffer, *bufidx);
-            *bufidx = 0;
+            escaped = input[0] | 0x20;
+            src = &escaped;
+            run = skip = 1;
+            hdlc->escape = 0;
         }
-        else if (*bufidx >= 0)
+        else
         {
-            if (*bufidx == bufsz)
-            {
-                log_error("HDLC buffer overflow");
-                *bufidx = -1;
-                continue;
-            }
-            buffer[(*bufidx)++] = byte;
+            const uint8_t *esc = memchr(input, 0x7D, inlen);
+            run = esc ? (size_t) (esc - input) : inlen;
+            skip = esc ? run + 1 : run;
+            hdlc->escape = (esc != NULL);
         }
+
+        if (run > (size_t) (bufsz - hdlc->idx))
+        {
+            log_error("HDLC buffer overflow");
+            hdlc->idx = -1;
+            return;
+        }
+        memcpy(buffer + hdlc->idx, src, run);
+        hdlc->idx += run;
+        input += skip;
+        inlen -= skip;
     }
 }
 
-static void process_fixed_ccc(frame_t *st, uint8_t *buf, unsigned int buflen)
+static void parse_hdlc(frame_t *st, void (*process)(frame_t *, uint8_t *, unsigned int), uint8_t *buffer, hdlc_t *hdlc, int bufsz, uint8_t *input, size_t inlen)
 {
-    buflen = unescape_hdlc(buf, buflen);
+    uint8_t *end = input + inlen;
+
+    while (input < end)
+    {
+        uint8_t *flag = memchr(input, 0x7E, end - input);
+
+        if (flag && hdlc->idx == 0 && !hdlc->escape && !memchr(input, 0x7D, flag - input))
+        {
+            // the whole frame is in the input, and has nothing to unescape
+            process(st, input, flag - input);
+        }
+        else
+        {
+            append_hdlc(hdlc, buffer, bufsz, input, (flag ? flag : end) - input);
+            if (flag && hdlc->idx >= 0)
+                process(st, buffer, hdlc->idx);
+        }
 
+        if (!flag)
+            break;
+        hdlc->idx = 0;
+        hdlc->escape = 0;
+        input = flag + 1;
+    }
+}
+
+static void process_fixed_ccc(frame_t *st, uint8_t *buf, unsigned int buflen)
+{
     // padding
     if (buflen == 0)
         return;
@@ -389,7 +326,8 @@ static void process_fixed_ccc(frame_t *st, uint8_t *buf, unsigned int buflen)
                 subch->mode = mode;
                 subch->length = length;
                 subch->block_idx = 0;
-                subch->idx = -1;
+                subch->hdlc.idx = -1;
+                subch->hdlc.escape = 0;
             }
             else
             {
@@ -405,7 +343,7 @@ static void process_fixed_ccc(frame_t *st, uint8_t *buf, unsigned int buflen)
 static void process_fixed_block(frame_t *st, int i)
 {
     fixed_subchannel_t *subch = &st->subchannel[i];
-    parse_hdlc(st, aas_push, subch->data, &subch->idx, MAX_AAS_LEN, &subch->blocks[4], 255);
+    parse_hdlc(st, aas_push, subch->data, &subch->hdlc, MAX_AAS_LEN, &subch->blocks[4], 255);
 }
 
 static size_t process_fixed_data(frame_t *st, size_t length)
@@ -427,7 +365,7 @@ static size_t process_fixed_data(frame_t *st, size_t length)
     }
 
     p -= st->sync_width;
-    parse_hdlc(st, process_fixed_ccc, st->ccc_buf, &st->ccc_idx, sizeof(st->ccc_buf), p, st->sync_width);
+    parse_hdlc(st, process_fixed_ccc, st->ccc_buf, &st->ccc_hdlc, sizeof(st->ccc_buf), p, st->sync_width);
 
     // wait until we have subchannel information
     if (!st->fixed_ready)
@@ -484,7 +422,7 @@ void frame_process(frame_t *st, size_t length)
         {
             // go back to coarse sync if we fail to decode any audio packets in a P1 frame
             if (length == MAX_PDU_LEN && offset == 0)
-                input_set_sync_state(st->input, SYNC_STATE_NONE);
+                input_request_resync(st->input);
             return;
         }
 
@@ -508,7 +446,7 @@ void frame_process(frame_t *st, size_t length)
             offset += parse_hef(st->buffer + offset, audio_end - offset, &hef);
         prog = hef.prog_num;
 
-        parse_hdlc(st, aas_push, st->psd_buf[prog], &st->psd_idx[prog], MAX_AAS_LEN, st->buffer + offset, start + hdr.la_location + 1 - offset);
+        parse_hdlc(st, aas_push, st->psd_buf[prog], &st->psd_hdlc[prog], MAX_AAS_LEN, st->buffer + offset, start + hdr.la_location + 1 - offset);
         offset = start + hdr.la_location + 1;
 
         for (j = 0; j < hdr.nop; ++j)
@@ -549,11 +487,39 @@ void frame_process(frame_t *st, size_t length)
 
 }
 
-void frame_push(frame_t *st, uint8_t *bits, size_t length)
+// bits are numbered from the MSB of each byte
+static inline unsigned int get_bit(const uint8_t *buf, unsigned int i)
+{
+    return (buf[i >> 3] >> (7 - (i & 7))) & 1;
+}
+
+// append 'count' bits from 'src', starting at bit 'sbit', to the zeroed
+// buffer 'dst' at bit 'dbit'
+static void append_bits(uint8_t *dst, unsigned int dbit, const uint8_t *src, unsigned int sbit, unsigned int count)
+{
+    unsigned int shift;
+
+    // leading bits, until the destination is byte aligned
+    for (; count > 0 && (dbit & 7); count--, dbit++, sbit++)
+        dst[dbit >> 3] |= get_bit(src, sbit) << (7 - (dbit & 7));
+
+    shift = sbit & 7;
+    for (; count >= 8; count -= 8, dbit += 8, sbit += 8)
+    {
+        const uint8_t *p = &src[sbit >> 3];
+        dst[dbit >> 3] = shift ? (p[0] << shift) | (p[1] >> (8 - shift)) : p[0];
+    }
+
+    for (; count > 0; count--, dbit++, sbit++)
+        dst[dbit >> 3] |= get_bit(src, sbit) << (7 - (dbit & 7));
+}
+
+void frame_push(frame_t *st, const uint8_t *buf, size_t length)
 {
     unsigned int start, offset;
-    unsigned int i, j = 0, h = 0, header = 0, val = 0;
-    uint8_t *ptr = st->buffer;
+    unsigned int h, pos = 0, header = 0;
+
+    pthread_mutex_lock(&st->mutex);
 
     switch (length)
     {
@@ -567,58 +533,62 @@ void frame_push(frame_t *st, uint8_t *bits, size_t length)
         break;
     default:
         log_error("Unknown frame length: %d", length);
+        pthread_mutex_unlock(&st->mutex);
+        return;
     }
 
-    for (i = 0; i < length; ++i)
+    // the PCI bits are spread through the frame; copy the data between them
+    memset(st->buffer, 0, (length - PCI_LEN) / 8);
+    for (h = 0; h < PCI_LEN; h++)
     {
-        // swap bit order
-        uint8_t bit = bits[((i>>3)<<3) + 7 - (i & 7)];
-        if (i >= start && ((i - start) % offset) == 0 && h < PCI_LEN)
-        {
-            header = (header << 1) | bit;
-            ++h;
-        }
-        else
-        {
-            val |= bit << (7 - j);
-            if (++j == 8)
-            {
-                *ptr++ = val;
-                val = 0;
-                j = 0;
-            }
-        }
+        unsigned int i = start + h * offset;
+        append_bits(st->buffer, pos - h, buf, pos, i - pos);
+        header = (header << 1) | get_bit(buf, i);
+        pos = i + 1;
     }
+    append_bits(st->buffer, pos - h, buf, pos, length - pos);
 
     st->pci = header;
-    frame_process(st, ptr - st->buffer);
+    frame_process(st, (length - PCI_LEN) / 8);
+
+    pthread_mutex_unlock(&st->mutex);
 }
 
 void frame_reset(frame_t *st)
 {
     unsigned int i;
 
+    pthread_mutex_lock(&st->mutex);
+
     st->pci = 0;
     for (i = 0; i < MAX_PROGRAMS; i++)
     {
         st->pdu_idx[i] = 0;
-        st->psd_idx[i] = -1;
+        st->psd_hdlc[i].idx = -1;
+        st->psd_hdlc[i].escape = 0;
     }
 
     st->fixed_ready = 0;
     st->sync_width = 0;
     st->sync_count = 0;
-    st->ccc_idx = -1;
+    st->ccc_hdlc.idx = -1;
+    st->ccc_hdlc.escape = 0;
+
+    pthread_mutex_unlock(&st->mutex);
 }
 
 void frame_init(frame_t *st, input_t *input)
 {
+    crc_init();
+
     st->input = input;
-    st->rs_dec = init_rs_char(8, 0x11d, 1, 1, 8);
+    st->rs_dec = init_rs_char(8, 0x11d, 1, 1, 8, RS_BLOCK_LEN - RS_CODEWORD_LEN);
+    pthread_mutex_init(&st->mutex, NULL);
     frame_reset(st);
 }
 
 void frame_free(frame_t *st)
 {
     free_rs_char(st->rs_dec);
+    pthread_mutex_destroy(&st->mutex);
 }
@@ -1,18 +1,26 @@
 #pragma once
 
+#include <pthread.h>
+
 #include "defines.h"
 
 #define MAX_AAS_LEN 8212
 #define RS_BLOCK_LEN 255
 #define RS_CODEWORD_LEN 96
 
+typedef struct
+{
+    int idx;    // bytes buffered, or -1 to skip to the next flag
+    int escape; // the last byte was an escape
+} hdlc_t;
+
 typedef struct
 {
     uint16_t mode;
     uint16_t length;
     unsigned int block_idx;
     uint8_t blocks[255 + 4];
-    int idx;
+    hdlc_t hdlc;
     uint8_t data[MAX_AAS_LEN];
 } fixed_subchannel_t;
 
@@ -25,18 +33,22 @@ typedef struct
     unsigned int pci;
     unsigned int program;
     uint8_t psd_buf[MAX_PROGRAMS][MAX_AAS_LEN];
-    int psd_idx[MAX_PROGRAMS];
+    hdlc_t psd_hdlc[MAX_PROGRAMS];
 
     unsigned int sync_width;
     unsigned int sync_count;
     uint8_t ccc_buf[32];
-    int ccc_idx;
+    hdlc_t ccc_hdlc;
     fixed_subchannel_t subchannel[4];
     int fixed_ready;
     void *rs_dec;
+
+    // P1 and P3 frames are pushed from different threads
+    pthread_mutex_t mutex;
 } frame_t;
 
-void frame_push(frame_t *st, uint8_t *bits, size_t length);
+// 'buf' holds 'length' bits, packed MSB first
+void frame_push(frame_t *st, const uint8_t *buf, size_t length);
 void frame_reset(frame_t *st);
 void frame_set_program(frame_t *st, unsigned int program);
 void frame_init(frame_t *st, struct input_t *input);
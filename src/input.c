@@ -38,23 +38,27 @@ static float decim_taps[] = {
     -0.00410953676328063
 };
 
-static void input_push_to_acquire(input_t *st)
+// drop samples between the ones kept by acquire and the rest of the input
+static void input_apply_skip(input_t *st)
 {
-    if (st->skip)
+    unsigned int i, count = st->avail - st->used - st->keep;
+
+    if (count > st->skip)
+        count = st->skip;
+
+    // move the kept samples forward, over the ones being dropped
+    for (i = st->keep; i > 0; i--)
     {
-        if (st->skip > st->avail - st->used)
-        {
-            st->skip -= st->avail - st->used;
-            st->used = st->avail;
-        }
-        else
-        {
-            st->used += st->skip;
-            st->skip = 0;
-        }
+        unsigned int from = (st->used + i - 1) & (INPUT_BUF_LEN - 1);
+        unsigned int to = (st->used + count + i - 1) & (INPUT_BUF_LEN - 1);
+
+        st->buffer[to] = st->buffer[from];
+        if (to < ACQUIRE_LEN)
+            st->buffer[INPUT_BUF_LEN + to] = st->buffer[to];
     }
 
-    st->used += acquire_push(&st->acq, &st->buffer[st->used], st->avail - st->used);
+    st->used += count;
+    st->skip -= count;
 }
 
 void input_pdu_push(input_t *st, uint8_t *pdu, unsigned int len, unsigned int program)
@@ -67,7 +71,7 @@ void input_set_skip(input_t *st, unsigned int skip)
     st->skip += skip;
 }
 
-static void measure_snr(input_t *st, uint8_t *buf, uint32_t len)
+static void measure_snr(input_t *st, const uint8_t *buf, uint32_t len)
 {
     unsigned int i, j;
 
@@ -113,83 +117,187 @@ static void measure_snr(input_t *st, uint8_t *buf, uint32_t len)
     }
 }
 
-int input_shift(input_t *st, unsigned int cnt)
+// contiguous space for new samples at the write position
+static cint16_t *input_get_space(input_t *st, unsigned int *space)
+{
+    unsigned int pos = st->avail & (INPUT_BUF_LEN - 1);
+
+    *space = INPUT_BUF_LEN - (st->avail - st->used);
+    if (*space > INPUT_BUF_LEN + ACQUIRE_LEN - pos)
+        *space = INPUT_BUF_LEN + ACQUIRE_LEN - pos;
+    return &st->buffer[pos];
+}
+
+static void input_commit(input_t *st, unsigned int cnt)
 {
-    if (cnt + st->avail > INPUT_BUF_LEN)
+    unsigned int pos = st->avail & (INPUT_BUF_LEN - 1), end = pos + cnt;
+
+    // samples written past the end belong at the start, and those written
+    // at the start are mirrored after the end
+    if (end > INPUT_BUF_LEN)
+        memcpy(&st->buffer[0], &st->buffer[INPUT_BUF_LEN], (end - INPUT_BUF_LEN) * sizeof(st->buffer[0]));
+    if (pos < ACQUIRE_LEN)
+        memcpy(&st->buffer[INPUT_BUF_LEN + pos], &st->buffer[pos], ((end < ACQUIRE_LEN ? end : ACQUIRE_LEN) - pos) * sizeof(st->buffer[0]));
+
+    st->avail += cnt;
+}
+
+static void input_push(input_t *st)
+{
+    while (1)
     {
-        if (st->avail > st->used)
-        {
-            memmove(&st->buffer[0], &st->buffer[st->used], (st->avail - st->used) * sizeof(st->buffer[0]));
-            st->avail -= st->used;
-            st->used = 0;
-        }
-        else
+        if (st->skip)
         {
-            st->avail = 0;
-            st->used = 0;
+            input_apply_skip(st);
+            if (st->skip)
+                break;
         }
-    }
 
-    if (cnt + st->avail > INPUT_BUF_LEN)
-    {
-        log_error("input buffer overflow!");
-        return -1;
-    }
+        if (st->avail - st->used < ACQUIRE_LEN)
+            break;
 
-    return 0;
+        if (atomic_exchange(&st->resync, 0))
+            input_set_sync_state(st, SYNC_STATE_NONE);
+
+        st->keep = ACQUIRE_LEN;
+        st->keep -= acquire_process(&st->acq, &st->buffer[st->used & (INPUT_BUF_LEN - 1)]);
+        st->used += ACQUIRE_LEN - st->keep;
+    }
 }
 
-void input_push(input_t *st)
+enum { FORMAT_CU8, FORMAT_CS8, FORMAT_CS16, FORMAT_CF32 };
+
+// resample count complex samples from the configured input rate
+static int input_push_resamp(input_t *st, int format, const void *buf, uint32_t count)
 {
-    while (st->avail - st->used >= FFTCP)
+    if (!st->resamp)
+    {
+        st->resamp = resamp_create(st->sample_rate ? st->sample_rate : SAMPLE_RATE, 0);
+        if (!st->resamp)
+            return 1;
+    }
+
+    while (count > 0)
     {
-        input_push_to_acquire(st);
-        acquire_process(&st->acq);
+        unsigned int space, n, out = 0;
+        cint16_t *y = input_get_space(st, &space);
+
+        // the input rate is at least the output rate, so n samples
+        // produce at most n + 1
+        n = count < space - 1 ? count : space - 1;
+        switch (format)
+        {
+        case FORMAT_CU8:
+            out = resamp_execute_cu8(st->resamp, buf, n, y);
+            buf = (const uint8_t *) buf + n * 2;
+            break;
+        case FORMAT_CS8:
+            out = resamp_execute_cs8(st->resamp, buf, n, y);
+            buf = (const int8_t *) buf + n * 2;
+            break;
+        case FORMAT_CS16:
+            out = resamp_execute_cs16(st->resamp, buf, n, y);
+            buf = (const int16_t *) buf + n * 2;
+            break;
+        case FORMAT_CF32:
+            out = resamp_execute(st->resamp, buf, n, y);
+            buf = (const float *) buf + n * 2;
+            break;
+        }
+        input_commit(st, out);
+        count -= n;
+
+        input_push(st);
     }
+
+    return 0;
 }
 
-void input_push_cu8(input_t *st, uint8_t *buf, uint32_t len)
+int input_push_cu8(input_t *st, const uint8_t *buf, uint32_t len)
 {
-    unsigned int i;
     assert(len % 4 == 0);
 
     if (st->snr_cb)
     {
         measure_snr(st, buf, len);
-        return;
+        return 0;
     }
 
     nrsc5_report_iq(st->radio, buf, len);
 
-    if (input_shift(st, len / 4) != 0)
-        return;
+    if (st->sample_rate && st->sample_rate != SAMPLE_RATE)
+        return input_push_resamp(st, FORMAT_CU8, buf, len / 2);
 
-    for (i = 0; i < len; i += 4)
+    while (len > 0)
     {
-        cint16_t x[2];
+        unsigned int space, count;
+        cint16_t *y = input_get_space(st, &space);
 
-        x[0].r = U8_Q15(buf[i]);
-        x[0].i = U8_Q15(buf[i + 1]);
-        x[1].r = U8_Q15(buf[i + 2]);
-        x[1].i = U8_Q15(buf[i + 3]);
+        count = len / 4 < space ? len / 4 : space;
+        input_commit(st, firdecim_q15_execute_block(st->decim, buf, count * 4, y));
+        buf += count * 4;
+        len -= count * 4;
 
-        halfband_q15_execute(st->decim, x, &st->buffer[st->avail++]);
+        input_push(st);
     }
 
-    input_push(st);
+    return 0;
 }
 
-void input_push_cs16(input_t *st, int16_t *buf, uint32_t len)
+int input_push_cs16(input_t *st, int16_t *buf, uint32_t len)
 {
     assert(len % 2 == 0);
 
-    if (input_shift(st, len / 2) != 0)
-        return;
+    // samples are already decimated unless an input rate was set
+    if (st->sample_rate)
+        return input_push_resamp(st, FORMAT_CS16, buf, len / 2);
+
+    while (len > 0)
+    {
+        unsigned int space, count;
+        cint16_t *y = input_get_space(st, &space);
+
+        count = len / 2 < space ? len / 2 : space;
+        memcpy(y, buf, count * sizeof(cint16_t));
+        input_commit(st, count);
+        buf += count * 2;
+        len -= count * 2;
+
+        input_push(st);
+    }
+
+    return 0;
+}
 
-    memcpy(&st->buffer[st->avail], buf, len * sizeof(int16_t));
-    st->avail += len / 2;
+int input_push_cs8(input_t *st, const int8_t *buf, uint32_t len)
+{
+    assert(len % 2 == 0);
+    return input_push_resamp(st, FORMAT_CS8, buf, len / 2);
+}
 
-    input_push(st);
+int input_push_cf32(input_t *st, const float *buf, uint32_t len)
+{
+    assert(len % 2 == 0);
+    return input_push_resamp(st, FORMAT_CF32, buf, len / 2);
+}
+
+int input_set_sample_rate(input_t *st, unsigned int sample_rate)
+{
+    resamp q = NULL;
+
+    // create the resampler now, so that running out of memory is reported here
+    if (sample_rate)
+    {
+        q = resamp_create(sample_rate, 0);
+        if (!q)
+            return 1;
+    }
+
+    if (st->resamp)
+        resamp_free(st->resamp);
+    st->resamp = q;
+    st->sample_rate = sample_rate;
+    return 0;
 }
 
 void input_set_snr_callback(input_t *st, input_snr_cb_t cb, void *arg)
@@ -202,6 +310,7 @@ void input_reset(input_t *st)
 {
     st->avail = 0;
     st->used = 0;
+    st->keep = 0;
     st->skip = 0;
     for (int i = 0; i < SNR_FFT_LEN; ++i)
         st->snr_power[i] = 0;
@@ -209,39 +318,66 @@ void input_reset(input_t *st)
 
     input_set_sync_state(st, SYNC_STATE_NONE);
     firdecim_q15_reset(st->decim);
+    if (st->resamp)
+        resamp_reset(st->resamp);
     acquire_reset(&st->acq);
     decode_reset(&st->decode);
+    atomic_store(&st->resync, 0);
     frame_reset(&st->frame);
     sync_reset(&st->sync);
 }
 
-void input_init(input_t *st, nrsc5_t *radio, output_t *output)
+// FFTW's planner is not thread-safe, and receivers may be opened and closed
+// on several threads at once
+static pthread_mutex_t fftw_planner_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void fftw_planner_lock(void)
+{
+    pthread_mutex_lock(&fftw_planner_mutex);
+}
+
+void fftw_planner_unlock(void)
+{
+    pthread_mutex_unlock(&fftw_planner_mutex);
+}
+
+int input_init(input_t *st, nrsc5_t *radio, output_t *output)
 {
     st->radio = radio;
     st->output = output;
     st->snr_cb = NULL;
     st->snr_cb_arg = NULL;
     st->sync_state = SYNC_STATE_NONE;
+    atomic_init(&st->resync, 0);
+
+    if (decode_init(&st->decode, st) != 0)
+        return 1;
 
     st->decim = firdecim_q15_create(decim_taps, sizeof(decim_taps) / sizeof(decim_taps[0]));
+    fftw_planner_lock();
     st->snr_fft = fftwf_plan_dft_1d(SNR_FFT_LEN, st->snr_fft_in, st->snr_fft_out, FFTW_FORWARD, 0);
+    fftw_planner_unlock();
 
     acquire_init(&st->acq, st);
-    decode_init(&st->decode, st);
     frame_init(&st->frame, st);
     sync_init(&st->sync, st);
 
     input_reset(st);
+    return 0;
 }
 
 void input_free(input_t *st)
 {
     acquire_free(&st->acq);
+    decode_free(&st->decode);
     frame_free(&st->frame);
 
     firdecim_q15_free(st->decim);
+    if (st->resamp)
+        resamp_free(st->resamp);
+    fftw_planner_lock();
     fftwf_destroy_plan(st->snr_fft);
-    fftwf_cleanup();
+    fftw_planner_unlock();
 }
 
 void input_set_sync_state(input_t *st, unsigned int new_state)
@@ -257,6 +393,13 @@ void input_set_sync_state(input_t *st, unsigned int new_state)
     st->sync_state = new_state;
 }
 
+// Called from the P1 decode thread. The demodulator owns sync_state, and
+// applies the request before its next acquire block.
+void input_request_resync(input_t *st)
+{
+    atomic_store(&st->resync, 1);
+}
+
 void input_aas_push(input_t *st, uint8_t *psd, unsigned int len)
 {
     output_aas_push(st->output, psd, len);
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdatomic.h>
 #include <stdint.h>
 #include <complex.h>
 
@@ -11,9 +12,11 @@
 #include "firdecim_q15.h"
 #include "frame.h"
 #include "output.h"
+#include "resamp.h"
 #include "sync.h"
 
-#define INPUT_BUF_LEN (FFTCP * 512)
+// ring of decimated samples, a power of two larger than ACQUIRE_LEN
+#define INPUT_BUF_LEN (1 << 18)
 
 #define SNR_FFT_COUNT 256
 #define SNR_FFT_LEN 64
@@ -32,9 +35,18 @@ typedef struct input_t
     output_t *output;
 
     firdecim_q15 decim;
-    cint16_t buffer[INPUT_BUF_LEN];
-    unsigned int avail, used, skip;
+    // input rate of piped samples, or zero for the native formats
+    unsigned int sample_rate;
+    resamp resamp;
+    // The first ACQUIRE_LEN samples are mirrored after the end, so that
+    // acquire can read a window starting anywhere in the ring. 'avail' and
+    // 'used' count samples written and consumed; the first 'keep' samples
+    // after 'used' have already been seen by acquire.
+    cint16_t buffer[INPUT_BUF_LEN + ACQUIRE_LEN];
+    unsigned int avail, used, keep, skip;
     unsigned int sync_state;
+    // set by the P1 decode thread to drop sync at the next block
+    atomic_int resync;
 
     fftwf_plan snr_fft;
     float complex snr_fft_in[SNR_FFT_LEN];
@@ -50,12 +62,19 @@ typedef struct input_t
     sync_t sync;
 } input_t;
 
-void input_init(input_t *st, nrsc5_t *radio, output_t *output);
+void fftw_planner_lock(void);
+void fftw_planner_unlock(void);
+
+int input_init(input_t *st, nrsc5_t *radio, output_t *output);
 void input_reset(input_t *st);
 void input_free(input_t *st);
 void input_set_sync_state(input_t *st, unsigned int new_state);
-void input_push_cu8(input_t *st, uint8_t *buf, uint32_t len);
-void input_push_cs16(input_t *st, int16_t *buf, uint32_t len);
+void input_request_resync(input_t *st);
+int input_push_cu8(input_t *st, const uint8_t *buf, uint32_t len);
+int input_push_cs16(input_t *st, int16_t *buf, uint32_t len);
+int input_push_cs8(input_t *st, const int8_t *buf, uint32_t len);
+int input_push_cf32(input_t *st, const float *buf, uint32_t len);
+int input_set_sample_rate(input_t *st, unsigned int sample_rate);
 void input_set_snr_callback(input_t *st, input_snr_cb_t cb, void *);
 void input_set_skip(input_t *st, unsigned int skip);
 void input_pdu_push(input_t *st, uint8_t *pdu, unsigned int len, unsigned int program);
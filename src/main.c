@@ -51,6 +51,7 @@ typedef struct {
     unsigned int device_index;
     int ppm_error;
     char *input_name;
+    unsigned int threads;
     ao_device *dev;
     FILE *hdc_file;
     FILE *iq_file;
@@ -392,6 +393,33 @@ static void restore_termios(void *arg)
 }
 #endif
 
+static int batch_cancel(void *opaque)
+{
+    state_t *st = opaque;
+    int done;
+
+    pthread_mutex_lock(&st->mutex);
+    done = st->done;
+    pthread_mutex_unlock(&st->mutex);
+    return done;
+}
+
+static void *batch_main(void *arg)
+{
+    state_t *st = arg;
+    FILE *fp = fopen(st->input_name, "rb");
+
+    if (fp == NULL)
+        log_error("Open IQ file failed.");
+    else if (nrsc5_decode_file(fp, st->threads, callback, st, batch_cancel) != 0)
+        log_error("Batch decoding failed.");
+
+    if (fp)
+        fclose(fp);
+    done_signal(st);
+    return NULL;
+}
+
 static void *input_main(void *arg)
 {
     state_t *st = arg;
@@ -447,7 +475,7 @@ static void *input_main(void *arg)
 
 static void help(const char *progname)
 {
-    fprintf(stderr, "Usage: %s [-v] [-q] [-l log-level] [-d device-index] [-p ppm-error] [-g gain] [-r iq-input] [-w iq-output] [-o wav-output] [--dump-hdc hdc-output] [--dump-aas-files directory] frequency program\n", progname);
+    fprintf(stderr, "Usage: %s [-v] [-q] [-l log-level] [-d device-index] [-p ppm-error] [-g gain] [-r iq-input] [-j threads] [-w iq-output] [-o wav-output] [--dump-hdc hdc-output] [--dump-aas-files directory] frequency program\n", progname);
 }
 
 static int parse_args(state_t *st, int argc, char *argv[])
@@ -464,7 +492,7 @@ static int parse_args(state_t *st, int argc, char *argv[])
 
     st->gain = -1;
 
-    while ((opt = getopt_long(argc, argv, "r:w:o:d:p:g:ql:v", long_opts, NULL)) != -1)
+    while ((opt = getopt_long(argc, argv, "r:j:w:o:d:p:g:ql:v", long_opts, NULL)) != -1)
     {
         switch (opt)
         {
@@ -477,6 +505,9 @@ static int parse_args(state_t *st, int argc, char *argv[])
         case 'r':
             st->input_name = strdup(optarg);
             break;
+        case 'j':
+            st->threads = strtoul(optarg, NULL, 10);
+            break;
         case 'w':
             output_name = optarg;
             break;
@@ -519,6 +550,12 @@ static int parse_args(state_t *st, int argc, char *argv[])
         return 1;
     }
 
+    if (st->threads > 0 && (!st->input_name || strcmp(st->input_name, "-") == 0))
+    {
+        log_fatal("Batch decoding requires an IQ input file.");
+        return -1;
+    }
+
     if (!st->input_name)
     {
         st->freq = strtof(argv[optind++], &endptr);
@@ -614,7 +651,7 @@ static void cleanup(state_t *st)
 int main(int argc, char *argv[])
 {
     pthread_mutex_t log_mutex;
-    pthread_t input_thread;
+    pthread_t input_thread, batch_thread;
     nrsc5_t *radio = NULL;
     state_t *st = calloc(1, sizeof(state_t));
 
@@ -631,7 +668,12 @@ int main(int argc, char *argv[])
     if (parse_args(st, argc, argv) != 0)
         return 0;
 
-    if (st->input_name)
+    if (st->threads > 0)
+    {
+        // segments of the file are decoded in parallel, without a receiver
+        pthread_create(&batch_thread, NULL, batch_main, st);
+    }
+    else if (st->input_name)
     {
         FILE *fp = strcmp(st->input_name, "-") == 0 ? stdin : fopen(st->input_name, "rb");
         if (fp == NULL)
@@ -653,15 +695,18 @@ int main(int argc, char *argv[])
             return 1;
         }
     }
-    if (nrsc5_set_frequency(radio, st->freq) != 0)
+    if (radio)
     {
-        log_fatal("Set frequency failed.");
-        return 1;
+        if (nrsc5_set_frequency(radio, st->freq) != 0)
+        {
+            log_fatal("Set frequency failed.");
+            return 1;
+        }
+        if (st->gain >= 0.0f)
+            nrsc5_set_gain(radio, st->gain);
+        nrsc5_set_callback(radio, callback, st);
+        nrsc5_start(radio);
     }
-    if (st->gain >= 0.0f)
-        nrsc5_set_gain(radio, st->gain);
-    nrsc5_set_callback(radio, callback, st);
-    nrsc5_start(radio);
 
     pthread_create(&input_thread, NULL, input_main, st);
 
@@ -700,8 +745,15 @@ int main(int argc, char *argv[])
     pthread_cancel(input_thread);
     pthread_join(input_thread, NULL);
 
-    nrsc5_stop(radio);
-    nrsc5_close(radio);
+    if (radio)
+    {
+        nrsc5_stop(radio);
+        nrsc5_close(radio);
+    }
+    else
+    {
+        pthread_join(batch_thread, NULL);
+    }
     cleanup(st);
     free(st);
     ao_shutdown();
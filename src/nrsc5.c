@@ -1,14 +1,15 @@
+#include "config.h"
+
 #include <assert.h>
 #include <string.h>
+#include <time.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #include "private.h"
 
-#ifdef __MINGW32__
-#define NRSC5_API __declspec(dllexport)
-#else
-#define NRSC5_API
-#endif
-
 static int snr_callback(void *arg, float snr)
 {
     nrsc5_t *st = arg;
@@ -78,10 +79,76 @@ static void worker_cb(uint8_t *buf, uint32_t len, void *arg)
 {
     nrsc5_t *st = arg;
 
+    // overruns are only counted here, and reported by the DSP thread
     if (st->stopped && st->dev)
         rtlsdr_cancel_async(st->dev);
     else
+        ring_write(&st->ring, buf, len);
+}
+
+static void *dsp_thread(void *arg)
+{
+    nrsc5_t *st = arg;
+    unsigned int overruns = 0;
+    time_t last_warning = 0;
+    uint8_t *buf;
+    size_t len;
+
+    while ((len = ring_peek(&st->ring, &buf, st->usb_buf_len)) > 0)
+    {
+        unsigned int count = atomic_load(&st->ring.overruns);
+
+        // at most one warning per second
+        if (count != overruns && time(NULL) != last_warning)
+        {
+            log_warn("Sample ring overrun, dropped %u transfers", count - overruns);
+            overruns = count;
+            last_warning = time(NULL);
+        }
+
         input_push_cu8(&st->input, buf, len);
+        ring_consume(&st->ring, len);
+    }
+
+    return NULL;
+}
+
+// returns non-zero at the end of the file
+static int push_file(nrsc5_t *st)
+{
+    int count;
+
+    if (st->iq_map)
+    {
+        size_t len = (st->iq_map_len - st->iq_map_pos) & ~(size_t) 3;
+        if (len > FILE_SPAN)
+            len = FILE_SPAN;
+
+        input_push_cu8(&st->input, st->iq_map + st->iq_map_pos, len);
+        st->iq_map_pos += len;
+        st->iq_bytes += len;
+        return st->iq_map_len - st->iq_map_pos < 4;
+    }
+
+    count = fread(st->samples_buf, 4, sizeof(st->samples_buf) / 4, st->iq_file);
+    if (count > 0)
+    {
+        input_push_cu8(&st->input, st->samples_buf, count * 4);
+        st->iq_bytes += count * 4;
+    }
+    return feof(st->iq_file) || ferror(st->iq_file);
+}
+
+static void report_file_speed(nrsc5_t *st)
+{
+    struct timespec now;
+    unsigned int rate = st->input.sample_rate ? st->input.sample_rate : SAMPLE_RATE;
+    double elapsed, duration = st->iq_bytes / (2.0 * rate);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - st->iq_start.tv_sec) + (now.tv_nsec - st->iq_start.tv_nsec) / 1e9;
+    if (elapsed > 0)
+        log_info("Processed %.1f s of samples in %.1f s (%.1fx real time)", duration, elapsed, duration / elapsed);
 }
 
 static void *worker_thread(void *arg)
@@ -93,6 +160,8 @@ static void *worker_thread(void *arg)
     {
         if (st->stopped && !st->worker_stopped)
         {
+            // deliver any frames still being decoded before reporting the stop
+            decode_wait(&st->input.decode);
             st->worker_stopped = 1;
             pthread_cond_broadcast(&st->worker_cond);
         }
@@ -101,6 +170,9 @@ static void *worker_thread(void *arg)
             st->worker_stopped = 0;
             pthread_cond_broadcast(&st->worker_cond);
 
+            st->iq_bytes = 0;
+            clock_gettime(CLOCK_MONOTONIC, &st->iq_start);
+
             if (st->dev)
             {
                 if (rtlsdr_reset_buffer(st->dev) != 0)
@@ -130,15 +202,19 @@ static void *worker_thread(void *arg)
 
             if (st->dev)
             {
-                err = rtlsdr_read_async(st->dev, worker_cb, st, 8, 512 * 1024);
+                err = rtlsdr_read_async(st->dev, worker_cb, st, st->usb_buf_count, st->usb_buf_len);
+                ring_drain(&st->ring);
             }
             else if (st->iq_file)
             {
-                int count = fread(st->samples_buf, 4, sizeof(st->samples_buf) / 4, st->iq_file);
-                if (count > 0)
-                    input_push_cu8(&st->input, st->samples_buf, count * 4);
-                if (feof(st->iq_file) || ferror(st->iq_file))
-                    err = 1;
+                err = push_file(st);
+            }
+
+            if (err)
+            {
+                decode_wait(&st->input.decode);
+                if (st->iq_file)
+                    report_file_speed(st);
             }
 
             pthread_mutex_lock(&st->worker_mutex);
@@ -155,7 +231,7 @@ static void *worker_thread(void *arg)
     return NULL;
 }
 
-static void nrsc5_init(nrsc5_t *st)
+static int nrsc5_init(nrsc5_t *st)
 {
     st->closed = 0;
     st->stopped = 1;
@@ -164,14 +240,21 @@ static void nrsc5_init(nrsc5_t *st)
     st->gain = -1;
     st->freq = NRSC5_SCAN_BEGIN;
     st->callback = NULL;
+    pthread_mutex_init(&st->report_mutex, NULL);
 
     output_init(&st->output, st);
-    input_init(&st->input, st, &st->output);
+    if (input_init(&st->input, st, &st->output) != 0)
+    {
+        output_free(&st->output);
+        pthread_mutex_destroy(&st->report_mutex);
+        return 1;
+    }
 
     // Create worker thread
     pthread_mutex_init(&st->worker_mutex, NULL);
     pthread_cond_init(&st->worker_cond, NULL);
     pthread_create(&st->worker, NULL, worker_thread, st);
+    return 0;
 }
 
 NRSC5_API void nrsc5_get_version(const char **version)
@@ -184,7 +267,7 @@ NRSC5_API int nrsc5_open(nrsc5_t **result, int device_index, int ppm_error)
     int err;
     nrsc5_t *st = calloc(1, sizeof(*st));
 
-    if (rtlsdr_open(&st->dev, device_index) != 0)
+    if (!st || rtlsdr_open(&st->dev, device_index) != 0)
         goto error_init;
 
     err = rtlsdr_set_sample_rate(st->dev, SAMPLE_RATE);
@@ -196,7 +279,19 @@ NRSC5_API int nrsc5_open(nrsc5_t **result, int device_index, int ppm_error)
     err = rtlsdr_set_offset_tuning(st->dev, 1);
     if (err && err != -2) goto error;
 
-    nrsc5_init(st);
+    st->usb_buf_count = USB_BUF_COUNT;
+    st->usb_buf_len = USB_BUF_LEN;
+    err = ring_init(&st->ring, RING_SIZE);
+    if (err) goto error;
+
+    if (nrsc5_init(st) != 0)
+    {
+        log_error("nrsc5_open error: out of memory");
+        ring_free(&st->ring);
+        rtlsdr_close(st->dev);
+        goto error_init;
+    }
+    pthread_create(&st->dsp, NULL, dsp_thread, st);
 
     *result = st;
     return 0;
@@ -215,9 +310,43 @@ NRSC5_API int nrsc5_open_file(nrsc5_t **result, FILE *fp)
     nrsc5_t *st;
 
     st = calloc(1, sizeof(*st));
+    if (!st)
+    {
+        *result = NULL;
+        return 1;
+    }
     st->iq_file = fp;
 
-    nrsc5_init(st);
+#ifdef HAVE_MMAP
+    {
+        struct stat sb;
+        off_t pos = ftello(fp);
+
+        if (pos >= 0 && fstat(fileno(fp), &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > pos
+            && (uint64_t) sb.st_size <= SIZE_MAX)
+        {
+            void *map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+            if (map != MAP_FAILED)
+            {
+                madvise(map, sb.st_size, MADV_SEQUENTIAL);
+                st->iq_map = map;
+                st->iq_map_len = sb.st_size;
+                st->iq_map_pos = pos;
+            }
+        }
+    }
+#endif
+
+    if (nrsc5_init(st) != 0)
+    {
+#ifdef HAVE_MMAP
+        if (st->iq_map)
+            munmap((void *) st->iq_map, st->iq_map_len);
+#endif
+        free(st);
+        *result = NULL;
+        return 1;
+    }
 
     *result = st;
     return 0;
@@ -228,8 +357,12 @@ NRSC5_API int nrsc5_open_pipe(nrsc5_t **result)
     nrsc5_t *st;
 
     st = calloc(1, sizeof(*st));
-
-    nrsc5_init(st);
+    if (!st || nrsc5_init(st) != 0)
+    {
+        free(st);
+        *result = NULL;
+        return 1;
+    }
 
     *result = st;
     return 0;
@@ -250,12 +383,22 @@ NRSC5_API void nrsc5_close(nrsc5_t *st)
     pthread_join(st->worker, NULL);
 
     if (st->dev)
+    {
+        ring_close(&st->ring);
+        pthread_join(st->dsp, NULL);
+        ring_free(&st->ring);
         rtlsdr_close(st->dev);
+    }
+#ifdef HAVE_MMAP
+    if (st->iq_map)
+        munmap((void *) st->iq_map, st->iq_map_len);
+#endif
     if (st->iq_file)
         fclose(st->iq_file);
 
     input_free(&st->input);
     output_free(&st->output);
+    pthread_mutex_destroy(&st->report_mutex);
     free(st);
 }
 
@@ -344,6 +487,41 @@ NRSC5_API void nrsc5_set_auto_gain(nrsc5_t *st, int enabled)
     st->gain = -1;
 }
 
+NRSC5_API void nrsc5_set_ber_interval(nrsc5_t *st, unsigned int interval)
+{
+    atomic_store(&st->input.decode.ber_interval, interval);
+}
+
+NRSC5_API int nrsc5_set_buffers(nrsc5_t *st, unsigned int ring_size, unsigned int usb_count, unsigned int usb_length)
+{
+    if (!st->stopped)
+        return 1;
+    if (usb_count == 0 || usb_length == 0 || usb_length % 512 != 0 || ring_size < usb_length)
+        return 1;
+
+    if (st->dev)
+    {
+        // the DSP thread is idle while stopped, and the ring empty
+        if (ring_resize(&st->ring, ring_size) != 0)
+            return 1;
+    }
+
+    st->usb_buf_count = usb_count;
+    st->usb_buf_len = usb_length;
+    return 0;
+}
+
+NRSC5_API void nrsc5_get_ring_stats(nrsc5_t *st, unsigned int *overruns, unsigned int *high_water)
+{
+    *overruns = atomic_load(&st->ring.overruns);
+    *high_water = atomic_load(&st->ring.high_water);
+}
+
+NRSC5_API void nrsc5_get_dropped_frames(nrsc5_t *st, unsigned int *count)
+{
+    *count = decode_get_dropped(&st->input.decode);
+}
+
 NRSC5_API void nrsc5_set_callback(nrsc5_t *st, nrsc5_callback_t callback, void *opaque)
 {
     pthread_mutex_lock(&st->worker_mutex);
@@ -354,22 +532,49 @@ NRSC5_API void nrsc5_set_callback(nrsc5_t *st, nrsc5_callback_t callback, void *
 
 NRSC5_API int nrsc5_pipe_samples_cu8(nrsc5_t *st, uint8_t *samples, unsigned int length)
 {
-    input_push_cu8(&st->input, samples, length);
-
-    return 0;
+    return input_push_cu8(&st->input, samples, length);
 }
 
 NRSC5_API int nrsc5_pipe_samples_cs16(nrsc5_t *st, int16_t *samples, unsigned int length)
 {
-    input_push_cs16(&st->input, samples, length);
+    return input_push_cs16(&st->input, samples, length);
+}
 
-    return 0;
+NRSC5_API int nrsc5_pipe_samples_cs8(nrsc5_t *st, int8_t *samples, unsigned int length)
+{
+    if (length % 2 != 0)
+        return 1;
+
+    return input_push_cs8(&st->input, samples, length);
+}
+
+NRSC5_API int nrsc5_pipe_samples_cf32(nrsc5_t *st, float *samples, unsigned int length)
+{
+    if (length % 2 != 0)
+        return 1;
+
+    return input_push_cf32(&st->input, samples, length);
+}
+
+NRSC5_API int nrsc5_set_sample_rate(nrsc5_t *st, unsigned int sample_rate)
+{
+    // RTL-SDR devices always run at SAMPLE_RATE
+    if (st->dev || !st->stopped)
+        return 1;
+    // the resampler only decimates
+    if (sample_rate != 0 && sample_rate < RESAMP_OUTPUT_RATE)
+        return 1;
+
+    return input_set_sample_rate(&st->input, sample_rate);
 }
 
 void nrsc5_report(nrsc5_t *st, const nrsc5_event_t *evt)
 {
+    // events are reported from both the demodulator and P1 decode threads
+    pthread_mutex_lock(&st->report_mutex);
     if (st->callback)
         st->callback(evt, st->callback_opaque);
+    pthread_mutex_unlock(&st->report_mutex);
 }
 
 void nrsc5_report_lost_device(nrsc5_t *st)
@@ -113,6 +113,7 @@ void output_init(output_t *st, nrsc5_t *radio)
 
     memset(st->ports, 0, sizeof(st->ports));
     memset(st->services, 0, sizeof(st->services));
+    st->lot_counter = 1;
 
     output_reset(st);
 }
@@ -484,7 +485,6 @@ static aas_file_t *find_free_lot(aas_port_t *port)
 
 static void process_port(output_t *st, uint16_t port_id, uint8_t *buf, unsigned int len)
 {
-    static unsigned int counter = 1;
     aas_port_t *port;
 
     if (st->services[0].type == SIG_SERVICE_NONE)
@@ -595,7 +595,7 @@ static void process_port(output_t *st, uint16_t port_id, uint8_t *buf, unsigned
             file->lot = lot;
             file->fragments = calloc(MAX_LOT_FRAGMENTS, sizeof(uint8_t*));
         }
-        file->timestamp = counter++;
+        file->timestamp = st->lot_counter++;
 
         if (seq == 0)
         {
@@ -130,6 +130,7 @@ typedef struct
 #endif
     aas_port_t ports[MAX_PORTS];
     sig_service_t services[MAX_SIG_SERVICES];
+    unsigned int lot_counter;
 } output_t;
 
 void output_push(output_t *st, uint8_t *pkt, unsigned int len, unsigned int program);
@@ -15,6 +15,7 @@
 
 #include <string.h>
 
+#include "crc.h"
 #include "defines.h"
 #include "pids.h"
 #include "private.h"
@@ -22,40 +23,10 @@
 
 static char *chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZ ?-*$ ";
 
-static uint16_t crc12(uint8_t *bits)
+static int check_crc12(const uint8_t *buf)
 {
-    uint16_t poly = 0xD010;
-    uint16_t reg = 0x0000;
-    int i, lowbit;
-
-    for (i = 67; i >= 0; i--)
-    {
-        lowbit = reg & 1;
-        reg >>= 1;
-        reg ^= ((uint16_t)bits[i] << 15);
-        if (lowbit) reg ^= poly;
-    }
-    for (i = 0; i < 16; i++)
-    {
-        lowbit = reg & 1;
-        reg >>= 1;
-        if (lowbit) reg ^= poly;
-    }
-    reg ^= 0x955;
-    return reg & 0xfff;
-}
-
-static int check_crc12(uint8_t *bits)
-{
-    uint16_t expected_crc = 0;
-    int i;
-
-    for (i = 68; i < 80; i++)
-    {
-        expected_crc <<= 1;
-        expected_crc |= bits[i];
-    }
-    return expected_crc == crc12(bits);
+    uint16_t expected_crc = ((buf[8] & 0xf) << 8) | buf[9];
+    return expected_crc == crc12(buf);
 }
 
 static unsigned int decode_int(uint8_t *bits, int *off, unsigned int length)
@@ -559,23 +530,27 @@ static void decode_sis(pids_t *st, uint8_t *bits)
         report(st);
 }
 
-void pids_frame_push(pids_t *st, uint8_t *bits)
+void pids_frame_push(pids_t *st, const uint8_t *buf)
 {
     int i;
-    uint8_t reversed[PIDS_FRAME_LEN];
+    uint8_t bits[PIDS_FRAME_LEN];
+
+    if (!check_crc12(buf))
+        return;
 
     for (i = 0; i < PIDS_FRAME_LEN; i++)
     {
-        reversed[i] = bits[((i>>3)<<3) + 7 - (i & 7)];
+        bits[i] = (buf[i >> 3] >> (7 - (i & 7))) & 1;
     }
-    if (check_crc12(reversed))
-        decode_sis(st, reversed);
+    decode_sis(st, bits);
 }
 
 void pids_init(pids_t *st, input_t *input)
 {
     int i;
 
+    crc_init();
+
     memset(st->country_code, 0, sizeof(st->country_code));
     st->fcc_facility_id = 0;
 
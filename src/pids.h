@@ -74,5 +74,5 @@ typedef struct
     int alert_displayed;
 } pids_t;
 
-void pids_frame_push(pids_t *st, uint8_t *bits);
+void pids_frame_push(pids_t *st, const uint8_t *buf);
 void pids_init(pids_t *st, struct input_t *input);
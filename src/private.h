@@ -10,11 +10,32 @@
 #include "defines.h"
 #include "input.h"
 #include "output.h"
+#include "ring.h"
+
+#ifdef __MINGW32__
+#define NRSC5_API __declspec(dllexport)
+#else
+#define NRSC5_API
+#endif
+
+// default sample buffering for RTL-SDR devices
+#define RING_SIZE (16 * 1024 * 1024)
+#define USB_BUF_COUNT 8
+#define USB_BUF_LEN (512 * 1024)
+
+// bytes of a memory-mapped IQ file passed to the input at a time
+#define FILE_SPAN (4 * 1024 * 1024)
 
 struct nrsc5_t
 {
     rtlsdr_dev_t *dev;
     FILE *iq_file;
+    // regular files are memory-mapped if possible
+    const uint8_t *iq_map;
+    size_t iq_map_len;
+    size_t iq_map_pos;
+    uint64_t iq_bytes;
+    struct timespec iq_start;
     uint8_t samples_buf[128 * 256];
     float freq;
     int gain;
@@ -27,9 +48,16 @@ struct nrsc5_t
     nrsc5_callback_t callback;
     void *callback_opaque;
 
+    // samples from the USB callback, decoded on the DSP thread
+    ring_t ring;
+    unsigned int usb_buf_count;
+    unsigned int usb_buf_len;
+    pthread_t dsp;
+
     pthread_t worker;
     pthread_mutex_t worker_mutex;
     pthread_cond_t worker_cond;
+    pthread_mutex_t report_mutex;
 
     input_t input;
     output_t output;
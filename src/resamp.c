@@ -0,0 +1,369 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Arbitrary ratio channel resampler
+ *
+ * Mixes a channel at a given offset down to baseband, low pass filters it
+ * and resamples it to the rate expected by the demodulator. Resampling uses
+ * a polyphase filter bank with linear interpolation between adjacent
+ * phases. The output time is tracked as an exact fraction of input samples,
+ * so there is no long-term drift for integer input rates. Integer samples are
+ * converted straight into the filter window, and the mixer is skipped when
+ * there is no offset.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#ifdef HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+#ifdef HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "resamp.h"
+
+// number of filter phases
+#define PHASES 64
+// input samples mixed and filtered per iteration
+#define BLOCK_SIZE 4096
+// filter length is a multiple of TAP_MULTIPLE, so that dot products can be
+// done four complex samples at a time without a remainder
+#define TAP_MULTIPLE 4
+// filter cutoff (-6 dB), transition width and stop band attenuation
+#define CUTOFF 300000.0
+#define TRANSITION 140000.0
+#define ATTENUATION 60.0
+// output scale, matching the native cu8 path (U8_Q15 and the halfband gain of 2)
+#define OUTPUT_SCALE 16384.0f
+
+struct resamp {
+    unsigned int ntaps;
+    // each tap is stored twice, to match the real and imaginary parts
+    float *taps;
+    float complex *window;
+    unsigned int avail;
+    unsigned int next;
+
+    // output time in input samples is next + rem / den
+    uint64_t rem, den, step;
+
+    // mixer
+    uint32_t phase, phase_inc;
+};
+
+static double bessel_i0(double x)
+{
+    double sum = 1, term = 1;
+
+    for (int k = 1; k < 50; k++)
+    {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+static int design_taps(resamp q, double input_rate)
+{
+    const unsigned int len = q->ntaps * PHASES;
+    const double beta = 0.1102 * (ATTENUATION - 8.7);
+    const double fc = CUTOFF / (input_rate * PHASES);
+    const double center = (len - 1) / 2.0;
+    double sum = 0;
+    double *proto = malloc(sizeof(double) * (len + PHASES));
+
+    if (!proto)
+        return 1;
+
+    // windowed sinc prototype at PHASES times the input rate
+    for (unsigned int n = 0; n < len; n++)
+    {
+        double t = n - center;
+        double r = t / center;
+        double sinc = (t == 0) ? 2 * fc : sin(2 * M_PI * fc * t) / (M_PI * t);
+        proto[n] = sinc * bessel_i0(beta * sqrt(1 - r * r)) / bessel_i0(beta);
+        sum += proto[n];
+    }
+    for (unsigned int n = len; n < len + PHASES; n++)
+        proto[n] = 0;
+
+    // split into phases, with an extra phase for interpolation, and reverse
+    // the taps so that each dot product runs forward through the window
+    for (unsigned int p = 0; p <= PHASES; p++)
+    {
+        for (unsigned int k = 0; k < q->ntaps; k++)
+        {
+            float *h = &q->taps[(p * q->ntaps + (q->ntaps - 1 - k)) * 2];
+            h[0] = h[1] = proto[k * PHASES + p] * PHASES / sum;
+        }
+    }
+
+    free(proto);
+    return 0;
+}
+
+resamp resamp_create(unsigned int input_rate, float offset)
+{
+    resamp q;
+    double ntaps;
+
+    q = calloc(1, sizeof(*q));
+    if (!q)
+        return NULL;
+
+    // Kaiser estimate of the filter length at the input rate
+    ntaps = (ATTENUATION - 8) / (2.285 * 2 * M_PI * TRANSITION / input_rate);
+    q->ntaps = ((unsigned int) ceil(ntaps) + TAP_MULTIPLE) & ~(TAP_MULTIPLE - 1);
+    q->taps = malloc(sizeof(float) * (PHASES + 1) * q->ntaps * 2);
+    q->window = malloc(sizeof(float complex) * (q->ntaps - 1 + BLOCK_SIZE));
+    if (!q->taps || !q->window || design_taps(q, input_rate) != 0)
+    {
+        resamp_free(q);
+        return NULL;
+    }
+
+    // output period is 2 * input_rate / SAMPLE_RATE input samples
+    q->den = SAMPLE_RATE;
+    q->step = 2 * (uint64_t) input_rate;
+    q->phase_inc = (uint32_t) (int64_t) llround(-(double) offset / input_rate * 4294967296.0);
+
+    resamp_reset(q);
+    return q;
+}
+
+void resamp_free(resamp q)
+{
+    free(q->taps);
+    free(q->window);
+    free(q);
+}
+
+void resamp_reset(resamp q)
+{
+    q->avail = q->ntaps - 1;
+    q->next = q->ntaps - 1;
+    q->rem = 0;
+    q->phase = 0;
+    memset(q->window, 0, sizeof(float complex) * q->avail);
+}
+
+unsigned int resamp_max_output(resamp q, unsigned int len)
+{
+    return (unsigned int) (((uint64_t) len * q->den) / q->step) + 1;
+}
+
+static void mix(resamp q, float complex *x, unsigned int len)
+{
+    if (q->phase_inc == 0)
+        return;
+
+    float complex rot = cexp(I * (2 * M_PI * q->phase / 4294967296.0));
+    const float complex inc = cexp(I * (2 * M_PI * (int32_t) q->phase_inc / 4294967296.0));
+
+    for (unsigned int i = 0; i < len; i++)
+    {
+        x[i] *= rot;
+        rot *= inc;
+    }
+    q->phase += q->phase_inc * len;
+}
+
+// dot products of the window with two adjacent filter phases
+static void dot2(const float *h0, const float *h1, const float complex *x, unsigned int ntaps, float complex *a, float complex *b)
+{
+#if defined(HAVE_SSE2)
+    const float *w = (const float *) x;
+    __m128 a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps();
+    __m128 b0 = _mm_setzero_ps(), b1 = _mm_setzero_ps();
+    float out[4];
+
+    for (unsigned int k = 0; k < ntaps * 2; k += 8)
+    {
+        __m128 w0 = _mm_loadu_ps(&w[k]);
+        __m128 w1 = _mm_loadu_ps(&w[k + 4]);
+
+        a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_loadu_ps(&h0[k]), w0));
+        a1 = _mm_add_ps(a1, _mm_mul_ps(_mm_loadu_ps(&h0[k + 4]), w1));
+        b0 = _mm_add_ps(b0, _mm_mul_ps(_mm_loadu_ps(&h1[k]), w0));
+        b1 = _mm_add_ps(b1, _mm_mul_ps(_mm_loadu_ps(&h1[k + 4]), w1));
+    }
+
+    // each register holds the sums of two complex samples
+    a0 = _mm_add_ps(a0, a1);
+    b0 = _mm_add_ps(b0, b1);
+    a0 = _mm_add_ps(a0, _mm_movehl_ps(a0, a0));
+    b0 = _mm_add_ps(b0, _mm_movehl_ps(b0, b0));
+    _mm_storel_pi((__m64 *) &out[0], a0);
+    _mm_storel_pi((__m64 *) &out[2], b0);
+    *a = CMPLXF(out[0], out[1]);
+    *b = CMPLXF(out[2], out[3]);
+#elif defined(HAVE_NEON)
+    const float *w = (const float *) x;
+    float32x4_t a0 = vdupq_n_f32(0), a1 = vdupq_n_f32(0);
+    float32x4_t b0 = vdupq_n_f32(0), b1 = vdupq_n_f32(0);
+    float32x2_t sa, sb;
+
+    for (unsigned int k = 0; k < ntaps * 2; k += 8)
+    {
+        float32x4_t w0 = vld1q_f32(&w[k]);
+        float32x4_t w1 = vld1q_f32(&w[k + 4]);
+
+        a0 = vmlaq_f32(a0, vld1q_f32(&h0[k]), w0);
+        a1 = vmlaq_f32(a1, vld1q_f32(&h0[k + 4]), w1);
+        b0 = vmlaq_f32(b0, vld1q_f32(&h1[k]), w0);
+        b1 = vmlaq_f32(b1, vld1q_f32(&h1[k + 4]), w1);
+    }
+
+    a0 = vaddq_f32(a0, a1);
+    b0 = vaddq_f32(b0, b1);
+    sa = vadd_f32(vget_low_f32(a0), vget_high_f32(a0));
+    sb = vadd_f32(vget_low_f32(b0), vget_high_f32(b0));
+    *a = CMPLXF(vget_lane_f32(sa, 0), vget_lane_f32(sa, 1));
+    *b = CMPLXF(vget_lane_f32(sb, 0), vget_lane_f32(sb, 1));
+#else
+    float complex sa = 0, sb = 0;
+
+    for (unsigned int k = 0; k < ntaps; k++)
+    {
+        sa += h0[k * 2] * x[k];
+        sb += h1[k * 2] * x[k];
+    }
+    *a = sa;
+    *b = sb;
+#endif
+}
+
+// Convert to Q15 at the level of the native cu8 path, which leaves headroom
+// above a full scale input. Peaks beyond it saturate instead of wrapping.
+static inline cint16_t to_cq15(float complex x)
+{
+    float r = crealf(x) * OUTPUT_SCALE, i = cimagf(x) * OUTPUT_SCALE;
+    cint16_t cq15;
+
+    cq15.r = r > 32767.0f ? 32767 : (r < -32767.0f ? -32767 : r);
+    cq15.i = i > 32767.0f ? 32767 : (i < -32767.0f ? -32767 : i);
+    return cq15;
+}
+
+// filter n samples loaded into the window after q->avail
+static unsigned int filter(resamp q, unsigned int n, cint16_t *y)
+{
+    unsigned int count = 0;
+
+    mix(q, &q->window[q->avail], n);
+    q->avail += n;
+
+    while (q->next < q->avail)
+    {
+        float frac = (float) ((double) q->rem * PHASES / q->den);
+        unsigned int p = (unsigned int) frac;
+        float mu = frac - p;
+        float complex a, b;
+
+        dot2(&q->taps[p * q->ntaps * 2], &q->taps[(p + 1) * q->ntaps * 2],
+             &q->window[q->next - (q->ntaps - 1)], q->ntaps, &a, &b);
+        y[count++] = to_cq15(a + mu * (b - a));
+
+        q->rem += q->step;
+        q->next += q->rem / q->den;
+        q->rem %= q->den;
+    }
+
+    // keep the filter history
+    memmove(q->window, &q->window[q->avail - (q->ntaps - 1)], sizeof(float complex) * (q->ntaps - 1));
+    q->next -= q->avail - (q->ntaps - 1);
+    q->avail = q->ntaps - 1;
+
+    return count;
+}
+
+unsigned int resamp_execute(resamp q, const float complex *x, unsigned int len, cint16_t *y)
+{
+    unsigned int count = 0;
+
+    while (len > 0)
+    {
+        unsigned int n = (len < BLOCK_SIZE) ? len : BLOCK_SIZE;
+
+        memcpy(&q->window[q->avail], x, sizeof(float complex) * n);
+        count += filter(q, n, &y[count]);
+        x += n;
+        len -= n;
+    }
+
+    return count;
+}
+
+unsigned int resamp_execute_cs16(resamp q, const int16_t *x, unsigned int len, cint16_t *y)
+{
+    unsigned int count = 0;
+
+    while (len > 0)
+    {
+        unsigned int n = (len < BLOCK_SIZE) ? len : BLOCK_SIZE;
+        float complex *w = &q->window[q->avail];
+
+        for (unsigned int i = 0; i < n; i++)
+            w[i] = CMPLXF(x[i * 2] / 32768.0f, x[i * 2 + 1] / 32768.0f);
+        count += filter(q, n, &y[count]);
+        x += n * 2;
+        len -= n;
+    }
+
+    return count;
+}
+
+unsigned int resamp_execute_cs8(resamp q, const int8_t *x, unsigned int len, cint16_t *y)
+{
+    unsigned int count = 0;
+
+    while (len > 0)
+    {
+        unsigned int n = (len < BLOCK_SIZE) ? len : BLOCK_SIZE;
+        float complex *w = &q->window[q->avail];
+
+        for (unsigned int i = 0; i < n; i++)
+            w[i] = CMPLXF(x[i * 2] / 128.0f, x[i * 2 + 1] / 128.0f);
+        count += filter(q, n, &y[count]);
+        x += n * 2;
+        len -= n;
+    }
+
+    return count;
+}
+
+unsigned int resamp_execute_cu8(resamp q, const uint8_t *x, unsigned int len, cint16_t *y)
+{
+    unsigned int count = 0;
+
+    while (len > 0)
+    {
+        unsigned int n = (len < BLOCK_SIZE) ? len : BLOCK_SIZE;
+        float complex *w = &q->window[q->avail];
+
+        for (unsigned int i = 0; i < n; i++)
+            w[i] = CMPLXF(U8_F(x[i * 2]), U8_F(x[i * 2 + 1]));
+        count += filter(q, n, &y[count]);
+        x += n * 2;
+        len -= n;
+    }
+
+    return count;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "defines.h"
+
+// output sample rate, matching the input of the demodulator (after decimation)
+#define RESAMP_OUTPUT_RATE (SAMPLE_RATE / 2.0)
+
+typedef struct resamp * resamp;
+
+resamp resamp_create(unsigned int input_rate, float offset);
+void resamp_free(resamp);
+void resamp_reset(resamp);
+unsigned int resamp_max_output(resamp, unsigned int len);
+// len is the number of complex input samples
+unsigned int resamp_execute(resamp q, const float complex *x, unsigned int len, cint16_t *y);
+unsigned int resamp_execute_cs16(resamp q, const int16_t *x, unsigned int len, cint16_t *y);
+unsigned int resamp_execute_cs8(resamp q, const int8_t *x, unsigned int len, cint16_t *y);
+unsigned int resamp_execute_cu8(resamp q, const uint8_t *x, unsigned int len, cint16_t *y);
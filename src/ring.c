@@ -0,0 +1,172 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ring.h"
+
+static size_t round_size(size_t size)
+{
+    size_t n = 4096;
+    while (n < size)
+        n <<= 1;
+    return n;
+}
+
+// The index update and the check of 'waiting' are both sequentially
+// consistent, as are the increment of 'waiting' and the re-check of the
+// indices by a sleeper, so one side always sees the other.
+static void wake(ring_t *r)
+{
+    if (atomic_load(&r->waiting))
+    {
+        pthread_mutex_lock(&r->mutex);
+        pthread_cond_broadcast(&r->cond);
+        pthread_mutex_unlock(&r->mutex);
+    }
+}
+
+int ring_init(ring_t *r, size_t size)
+{
+    r->size = round_size(size);
+    r->buf = malloc(r->size);
+    if (!r->buf)
+        return 1;
+
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    atomic_init(&r->overruns, 0);
+    atomic_init(&r->high_water, 0);
+    atomic_init(&r->waiting, 0);
+    r->closed = 0;
+    pthread_mutex_init(&r->mutex, NULL);
+    pthread_cond_init(&r->cond, NULL);
+    return 0;
+}
+
+int ring_resize(ring_t *r, size_t size)
+{
+    uint8_t *buf;
+
+    size = round_size(size);
+    if (size == r->size)
+        return 0;
+
+    buf = malloc(size);
+    if (!buf)
+        return 1;
+
+    // the ring is empty, so the indices stay valid under the new mask; the
+    // DSP thread may be waiting in ring_peek with its copy of 'tail'
+    free(r->buf);
+    r->buf = buf;
+    r->size = size;
+    atomic_store(&r->high_water, 0);
+    return 0;
+}
+
+void ring_free(ring_t *r)
+{
+    free(r->buf);
+    pthread_mutex_destroy(&r->mutex);
+    pthread_cond_destroy(&r->cond);
+}
+
+int ring_write(ring_t *r, const uint8_t *data, size_t len)
+{
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    size_t offset = head & (r->size - 1);
+    size_t first = r->size - offset;
+
+    if (len > r->size - (head - tail))
+    {
+        atomic_fetch_add_explicit(&r->overruns, 1, memory_order_relaxed);
+        return 1;
+    }
+
+    if (first >= len)
+    {
+        memcpy(&r->buf[offset], data, len);
+    }
+    else
+    {
+        memcpy(&r->buf[offset], data, first);
+        memcpy(r->buf, data + first, len - first);
+    }
+
+    if (head + len - tail > atomic_load_explicit(&r->high_water, memory_order_relaxed))
+        atomic_store_explicit(&r->high_water, head + len - tail, memory_order_relaxed);
+
+    atomic_store(&r->head, head + len);
+    wake(r);
+    return 0;
+}
+
+size_t ring_peek(ring_t *r, uint8_t **data, size_t max)
+{
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    size_t avail, offset;
+
+    while ((avail = atomic_load_explicit(&r->head, memory_order_acquire) - tail) == 0)
+    {
+        int closed;
+
+        pthread_mutex_lock(&r->mutex);
+        atomic_fetch_add(&r->waiting, 1);
+        while (atomic_load(&r->head) == tail && !r->closed)
+            pthread_cond_wait(&r->cond, &r->mutex);
+        atomic_fetch_sub(&r->waiting, 1);
+        closed = r->closed;
+        pthread_mutex_unlock(&r->mutex);
+
+        if (closed)
+            return 0;
+    }
+
+    offset = tail & (r->size - 1);
+    if (avail > r->size - offset)
+        avail = r->size - offset;
+    if (avail > max)
+        avail = max;
+
+    *data = &r->buf[offset];
+    return avail;
+}
+
+void ring_consume(ring_t *r, size_t len)
+{
+    atomic_store(&r->tail, atomic_load_explicit(&r->tail, memory_order_relaxed) + len);
+    wake(r);
+}
+
+void ring_drain(ring_t *r)
+{
+    pthread_mutex_lock(&r->mutex);
+    atomic_fetch_add(&r->waiting, 1);
+    while (atomic_load(&r->head) != atomic_load(&r->tail) && !r->closed)
+        pthread_cond_wait(&r->cond, &r->mutex);
+    atomic_fetch_sub(&r->waiting, 1);
+    pthread_mutex_unlock(&r->mutex);
+}
+
+void ring_close(ring_t *r)
+{
+    pthread_mutex_lock(&r->mutex);
+    r->closed = 1;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->mutex);
+}
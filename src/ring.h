@@ -0,0 +1,37 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Single-producer, single-consumer byte ring. The producer never blocks: a
+// write that doesn't fit is dropped whole and counted as an overrun. The
+// consumer reads in place and releases the bytes once it is done with them.
+typedef struct
+{
+    uint8_t *buf;
+    size_t size;
+    atomic_size_t head;
+    atomic_size_t tail;
+    atomic_uint overruns;
+    atomic_size_t high_water;
+    // threads sleeping on cond, woken when head or tail moves
+    atomic_int waiting;
+    int closed;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} ring_t;
+
+// sizes are rounded up to a power of two
+int ring_init(ring_t *r, size_t size);
+// only while empty; the high water mark starts over
+int ring_resize(ring_t *r, size_t size);
+void ring_free(ring_t *r);
+int ring_write(ring_t *r, const uint8_t *data, size_t len);
+// wait for data, and return up to 'max' contiguous bytes; 0 once closed
+size_t ring_peek(ring_t *r, uint8_t **data, size_t max);
+void ring_consume(ring_t *r, size_t len);
+// wait until everything written has been consumed
+void ring_drain(ring_t *r);
+void ring_close(ring_t *r);
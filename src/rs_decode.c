@@ -31,13 +31,9 @@ DTYPE *data, int *eras_pos, int no_eras){
   for(i=0;(unsigned int)i<NROOTS;i++)
     s[i] = data[0];
 
-  for(j=1;(unsigned int)j<NN;j++){
+  for(j=1;(unsigned int)j<NN-PAD;j++){
     for(i=0;(unsigned int)i<NROOTS;i++){
-      if(s[i] == 0){
-	s[i] = data[j];
-      } else {
-	s[i] = data[j] ^ ALPHA_TO[MODNN(INDEX_OF[s[i]] + (FCR+i)*PRIM)];
-      }
+      s[i] = data[j] ^ SYN_MUL(i)[s[i]];
     }
   }
 
@@ -60,9 +56,9 @@ DTYPE *data, int *eras_pos, int no_eras){
 
   if (no_eras > 0) {
     /* Init lambda to be the erasure locator polynomial */
-    lambda[1] = ALPHA_TO[MODNN(PRIM*(NN-1-eras_pos[0]))];
+    lambda[1] = ALPHA_TO[MODNN(PRIM*(NN-1-PAD-eras_pos[0]))];
     for (i = 1; i < no_eras; i++) {
-      u = MODNN(PRIM*(NN-1-eras_pos[i]));
+      u = MODNN(PRIM*(NN-1-PAD-eras_pos[i]));
       for (j = i+1; j > 0; j--) {
 	tmp = INDEX_OF[lambda[j - 1]];
 	if(tmp != A0)
@@ -198,13 +194,18 @@ DTYPE *data, int *eras_pos, int no_eras){
     }
     /* Apply error to data */
     if (num1 != 0) {
-      data[loc[j]] ^= ALPHA_TO[MODNN(INDEX_OF[num1] + INDEX_OF[num2] + NN - INDEX_OF[den])];
+      if (loc[j] < PAD) {
+	/* Error in the padding, which is known to be zero */
+	count = -1;
+	goto finish;
+      }
+      data[loc[j]-PAD] ^= ALPHA_TO[MODNN(INDEX_OF[num1] + INDEX_OF[num2] + NN - INDEX_OF[den])];
     }
   }
  finish:
   if(eras_pos != NULL){
     for(i=0;i<count;i++)
-      eras_pos[i] = loc[i];
+      eras_pos[i] = loc[i] - PAD;
   }
   return count;
 }
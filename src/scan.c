@@ -0,0 +1,390 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Band scan
+ *
+ * Classifies every channel within a capture from an averaged power spectrum,
+ * in the same way as the SNR measurement used for automatic gain. A channel
+ * carries an analog station if power is concentrated around its center, and a
+ * hybrid station if both digital sidebands rise above the noise floor with
+ * a flat top and a sharp outer edge. All channels are evaluated from the
+ * same FFT, so a wideband capture is scanned in a single pass.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "private.h"
+
+// channels from NRSC5_SCAN_BEGIN to NRSC5_SCAN_END
+#define SCAN_CHANNELS 101
+// maximum width of an FFT bin in Hz
+#define SCAN_BIN_WIDTH 2000
+// seconds of samples between classifications
+#define SCAN_INTERVAL 0.01
+// seconds of samples captured at each tuning of the RTL-SDR
+#define SCAN_DWELL 0.05
+// fraction of the capture bandwidth not affected by the anti-alias filter
+#define SCAN_USABLE 0.9
+// fraction of the spectrum assumed to contain only noise
+#define SCAN_NOISE_PERCENTILE 0.1
+
+// channel regions, as offsets in Hz from the center of the channel
+#define SCAN_CARRIER_WIDTH 60000
+#define SCAN_SIDEBAND_INNER 135000
+#define SCAN_SIDEBAND_MID 165000
+#define SCAN_SIDEBAND_OUTER 195000
+#define SCAN_EDGE_INNER 205000
+#define SCAN_EDGE_OUTER 230000
+
+// detection thresholds (power ratios)
+#define SCAN_ANALOG_THRESHOLD 10.0f
+#define SCAN_HYBRID_THRESHOLD 2.0f
+#define SCAN_EDGE_THRESHOLD 2.0f
+#define SCAN_FLATNESS 2.0f
+
+typedef struct
+{
+    float freq;
+    int active;
+    int type;
+    float cnr;
+    float time;
+} scan_channel_t;
+
+struct nrsc5_scan_t
+{
+    unsigned int sample_rate;
+    float center_freq;
+
+    unsigned int fft_len;
+    fftwf_plan fft;
+    float complex *fft_in;
+    float complex *fft_out;
+    float *window;
+    float *power;
+    float *sorted;
+    unsigned int fill;
+    unsigned int fft_cnt;
+    unsigned int interval;
+
+    scan_channel_t channels[SCAN_CHANNELS];
+};
+
+static int compare_float(const void *a, const void *b)
+{
+    float x = *(const float *) a, y = *(const float *) b;
+    return (x > y) - (x < y);
+}
+
+static int compare_result(const void *a, const void *b)
+{
+    const nrsc5_scan_result_t *x = a, *y = b;
+    if (x->type != y->type)
+        return y->type - x->type;
+    return (y->cnr > x->cnr) - (y->cnr < x->cnr);
+}
+
+// mean power of the bins between two offsets from the center of the capture
+static float band_power(nrsc5_scan_t *st, float lo, float hi)
+{
+    float df = (float) st->sample_rate / st->fft_len;
+    int start = (int) ceilf(lo / df) + st->fft_len / 2;
+    int end = (int) floorf(hi / df) + st->fft_len / 2;
+    float sum = 0;
+
+    for (int i = start; i <= end; i++)
+        sum += st->power[i];
+    return sum / ((end - start + 1) * st->fft_cnt);
+}
+
+static float noise_power(nrsc5_scan_t *st)
+{
+    unsigned int margin = st->fft_len * (1 - SCAN_USABLE) / 2;
+    unsigned int count = st->fft_len - 2 * margin;
+
+    memcpy(st->sorted, &st->power[margin], count * sizeof(float));
+    qsort(st->sorted, count, sizeof(float), compare_float);
+    return st->sorted[(unsigned int) (count * SCAN_NOISE_PERCENTILE)] / st->fft_cnt;
+}
+
+static void classify(nrsc5_scan_t *st)
+{
+    float noise = noise_power(st);
+    float now = (float) st->fft_cnt * st->fft_len / st->sample_rate;
+
+    for (unsigned int i = 0; i < SCAN_CHANNELS; i++)
+    {
+        scan_channel_t *ch = &st->channels[i];
+        float o = ch->freq - st->center_freq;
+        int type = NRSC5_SCAN_NONE;
+        float cnr = 0;
+
+        if (!ch->active)
+            continue;
+
+        float carrier = band_power(st, o - SCAN_CARRIER_WIDTH, o + SCAN_CARRIER_WIDTH);
+        float lower_in = band_power(st, o - SCAN_SIDEBAND_MID, o - SCAN_SIDEBAND_INNER);
+        float lower_out = band_power(st, o - SCAN_SIDEBAND_OUTER, o - SCAN_SIDEBAND_MID);
+        float upper_in = band_power(st, o + SCAN_SIDEBAND_INNER, o + SCAN_SIDEBAND_MID);
+        float upper_out = band_power(st, o + SCAN_SIDEBAND_MID, o + SCAN_SIDEBAND_OUTER);
+        float lower_edge = band_power(st, o - SCAN_EDGE_OUTER, o - SCAN_EDGE_INNER);
+        float upper_edge = band_power(st, o + SCAN_EDGE_INNER, o + SCAN_EDGE_OUTER);
+        float lower = (lower_in + lower_out) / 2;
+        float upper = (upper_in + upper_out) / 2;
+        float sideband = fminf(lower, upper);
+
+        // out of band emissions of an analog station fall off with frequency,
+        // while the digital sidebands are flat and end abruptly
+        int flat = lower_in < lower_out * SCAN_FLATNESS && lower_out < lower_in * SCAN_FLATNESS
+                && upper_in < upper_out * SCAN_FLATNESS && upper_out < upper_in * SCAN_FLATNESS;
+        int edge = lower > lower_edge * SCAN_EDGE_THRESHOLD || upper > upper_edge * SCAN_EDGE_THRESHOLD;
+
+        if (sideband > noise * SCAN_HYBRID_THRESHOLD && flat && edge)
+        {
+            type = NRSC5_SCAN_HYBRID;
+            cnr = sideband / noise;
+        }
+        else if (carrier > noise * SCAN_ANALOG_THRESHOLD && carrier > fmaxf(lower, upper) * SCAN_ANALOG_THRESHOLD)
+        {
+            type = NRSC5_SCAN_ANALOG;
+            cnr = carrier / noise;
+        }
+
+        if (type != ch->type)
+        {
+            ch->type = type;
+            ch->time = now;
+        }
+        ch->cnr = 10 * log10f(cnr);
+    }
+}
+
+static void scan_push(nrsc5_scan_t *st, float complex x)
+{
+    st->fft_in[st->fill] = x * st->window[st->fill];
+    if (++st->fill < st->fft_len)
+        return;
+
+    fftwf_execute(st->fft);
+    for (unsigned int i = 0; i < st->fft_len; i++)
+        st->power[(i + st->fft_len / 2) % st->fft_len] += normf(st->fft_out[i]);
+
+    st->fill = 0;
+    if (++st->fft_cnt % st->interval == 0)
+        classify(st);
+}
+
+static void scan_set_center(nrsc5_scan_t *st, float center_freq)
+{
+    float limit = SCAN_USABLE * st->sample_rate / 2 - SCAN_EDGE_OUTER;
+
+    st->center_freq = center_freq;
+    for (unsigned int i = 0; i < SCAN_CHANNELS; i++)
+    {
+        scan_channel_t *ch = &st->channels[i];
+        ch->active = fabsf(ch->freq - center_freq) <= limit;
+    }
+
+    st->fill = 0;
+    st->fft_cnt = 0;
+    memset(st->power, 0, st->fft_len * sizeof(float));
+}
+
+NRSC5_API int nrsc5_scan_open(nrsc5_scan_t **result, unsigned int sample_rate, float center_freq)
+{
+    nrsc5_scan_t *st;
+    unsigned int fft_len = 64;
+
+    // a channel must fit within the capture
+    if (sample_rate < 2 * (SCAN_EDGE_OUTER / SCAN_USABLE))
+    {
+        *result = NULL;
+        return 1;
+    }
+
+    while (sample_rate / fft_len > SCAN_BIN_WIDTH)
+        fft_len *= 2;
+
+    st = calloc(1, sizeof(*st));
+    if (!st)
+    {
+        *result = NULL;
+        return 1;
+    }
+    st->sample_rate = sample_rate;
+    st->fft_len = fft_len;
+    st->interval = (unsigned int) (SCAN_INTERVAL * sample_rate / fft_len);
+    if (st->interval == 0)
+        st->interval = 1;
+
+    st->fft_in = fftwf_malloc(fft_len * sizeof(float complex));
+    st->fft_out = fftwf_malloc(fft_len * sizeof(float complex));
+    if (st->fft_in && st->fft_out)
+    {
+        fftw_planner_lock();
+        st->fft = fftwf_plan_dft_1d(fft_len, st->fft_in, st->fft_out, FFTW_FORWARD, 0);
+        fftw_planner_unlock();
+    }
+    st->window = malloc(fft_len * sizeof(float));
+    st->power = malloc(fft_len * sizeof(float));
+    st->sorted = malloc(fft_len * sizeof(float));
+    if (!st->fft || !st->window || !st->power || !st->sorted)
+    {
+        nrsc5_scan_close(st);
+        *result = NULL;
+        return 1;
+    }
+
+    for (unsigned int i = 0; i < fft_len; i++)
+        st->window[i] = powf(sinf(M_PI * i / (fft_len - 1)), 2);
+
+    for (unsigned int i = 0; i < SCAN_CHANNELS; i++)
+    {
+        st->channels[i].freq = NRSC5_SCAN_BEGIN + i * NRSC5_SCAN_SKIP;
+        st->channels[i].type = NRSC5_SCAN_NONE;
+    }
+    scan_set_center(st, center_freq);
+
+    *result = st;
+    return 0;
+}
+
+NRSC5_API void nrsc5_scan_close(nrsc5_scan_t *st)
+{
+    if (!st)
+        return;
+
+    if (st->fft)
+    {
+        fftw_planner_lock();
+        fftwf_destroy_plan(st->fft);
+        fftw_planner_unlock();
+    }
+    fftwf_free(st->fft_in);
+    fftwf_free(st->fft_out);
+    free(st->window);
+    free(st->power);
+    free(st->sorted);
+    free(st);
+}
+
+NRSC5_API int nrsc5_scan_pipe_samples_cu8(nrsc5_scan_t *st, uint8_t *samples, unsigned int length)
+{
+    if (length % 2 != 0)
+        return 1;
+
+    for (unsigned int i = 0; i < length; i += 2)
+        scan_push(st, CMPLXF(U8_F(samples[i]), U8_F(samples[i + 1])));
+    return 0;
+}
+
+NRSC5_API int nrsc5_scan_pipe_samples_cs16(nrsc5_scan_t *st, int16_t *samples, unsigned int length)
+{
+    if (length % 2 != 0)
+        return 1;
+
+    for (unsigned int i = 0; i < length; i += 2)
+        scan_push(st, CMPLXF(samples[i] / 32768.0f, samples[i + 1] / 32768.0f));
+    return 0;
+}
+
+NRSC5_API int nrsc5_scan_pipe_samples_cf32(nrsc5_scan_t *st, float *samples, unsigned int length)
+{
+    if (length % 2 != 0)
+        return 1;
+
+    for (unsigned int i = 0; i < length; i += 2)
+        scan_push(st, CMPLXF(samples[i], samples[i + 1]));
+    return 0;
+}
+
+NRSC5_API void nrsc5_scan_get_results(nrsc5_scan_t *st, nrsc5_scan_result_t *results, unsigned int *count)
+{
+    nrsc5_scan_result_t found[SCAN_CHANNELS];
+    unsigned int n = 0;
+
+    for (unsigned int i = 0; i < SCAN_CHANNELS; i++)
+    {
+        scan_channel_t *ch = &st->channels[i];
+        if (ch->type == NRSC5_SCAN_NONE)
+            continue;
+
+        found[n].freq = ch->freq;
+        found[n].type = ch->type;
+        found[n].cnr = ch->cnr;
+        found[n].time = ch->time;
+        n++;
+    }
+
+    // strongest hybrid stations first, followed by analog stations
+    qsort(found, n, sizeof(found[0]), compare_result);
+
+    if (n > *count)
+        n = *count;
+    memcpy(results, found, n * sizeof(found[0]));
+    *count = n;
+}
+
+NRSC5_API int nrsc5_scan(nrsc5_t *radio, nrsc5_scan_result_t *results, unsigned int *count)
+{
+    // tune between channels to keep them away from the DC offset, covering
+    // four channels (-300, -100, +100 and +300 kHz) at each step
+    const float first = NRSC5_SCAN_BEGIN + 1.5 * NRSC5_SCAN_SKIP;
+    const float step = 4 * NRSC5_SCAN_SKIP;
+    nrsc5_scan_t *st;
+    int ret = 1;
+
+    if (!radio->dev || !radio->stopped)
+        return 1;
+
+    if (nrsc5_scan_open(&st, SAMPLE_RATE, first) != 0)
+        return 1;
+
+    for (float freq = first; freq - 1.5 * NRSC5_SCAN_SKIP <= NRSC5_SCAN_END; freq += step)
+    {
+        int len = sizeof(radio->samples_buf);
+
+        if (rtlsdr_set_center_freq(radio->dev, freq) != 0)
+            goto error;
+        if (rtlsdr_reset_buffer(radio->dev) != 0)
+            goto error;
+
+        // discard samples captured while the tuner settles
+        if (rtlsdr_read_sync(radio->dev, radio->samples_buf, len, &len) != 0)
+            goto error;
+
+        scan_set_center(st, freq);
+        while (st->fft_cnt < SCAN_DWELL * SAMPLE_RATE / st->fft_len)
+        {
+            len = sizeof(radio->samples_buf);
+            if (rtlsdr_read_sync(radio->dev, radio->samples_buf, len, &len) != 0)
+                goto error;
+            nrsc5_scan_pipe_samples_cu8(st, radio->samples_buf, len);
+        }
+        log_debug("Scanned %.1f MHz", freq / 1e6);
+    }
+
+    nrsc5_scan_get_results(st, results, count);
+    ret = 0;
+
+error:
+    nrsc5_scan_close(st);
+    if (rtlsdr_set_center_freq(radio->dev, radio->freq) != 0)
+        log_error("rtlsdr_set_center_freq failed");
+    return ret;
+}
@@ -15,56 +15,333 @@
 
 #include "config.h"
 
+#include <float.h>
 #include <math.h>
 
+#ifdef HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+#ifdef HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
 #include "defines.h"
 #include "input.h"
 #include "private.h"
 #include "sync.h"
 
 #define PM_PARTITIONS 10
-#define MAX_PARTITIONS 14
 #define PARTITION_DATA_CARRIERS 18
-#define PARTITION_WIDTH 19
+// row length of the per-symbol arrays used by the Costas loops, rounded up
+// to a multiple of 4 for alignment
+#define REF_LANES ((MAX_REF_CARRIERS + 3) & ~3)
+
+// compact buffer index of lower sideband carrier LB_START + i
+#define LB(i) (i)
+// compact buffer index of upper sideband carrier UB_END - i
+#define UB(i) (SYNC_CARRIERS - 1 - (i))
+
+// FFT bin of a compact buffer index
+static int carrier_bin(unsigned int c)
+{
+    return c < SIDEBAND_CARRIERS ? LB_START + (int) c : UB_END - (int) (SYNC_CARRIERS - 1 - c);
+}
+
+// Polynomial approximations of atan2 and sincos, used by the Costas loops
+// so that they can be computed for several subcarriers at once. Error is
+// below 1e-6 radians.
+
+// atan(a) / a as a polynomial in a^2, for |a| <= 1 (Abramowitz and Stegun 4.4.49)
+static const float atan_poly[] = {
+    0.0028662257f, -0.0161657367f, 0.0429096138f, -0.0752896400f,
+    0.1065626393f, -0.1420889944f, 0.1999355085f, -0.3333314528f, 1
+};
+// sin(h) / h and cos(h) as polynomials in h^2, for |h| <= pi / 2
+static const float sin_poly[] = {
+    -1.0f / 39916800, 1.0f / 362880, -1.0f / 5040, 1.0f / 120, -1.0f / 6, 1
+};
+static const float cos_poly[] = {
+    1.0f / 479001600, -1.0f / 3628800, 1.0f / 40320, -1.0f / 720, 1.0f / 24, -0.5f, 1
+};
+
+#define POLY_LEN(p) (sizeof(p) / sizeof(p[0]))
+
+static float fast_atan2f(float y, float x)
+{
+    float ax = fabsf(x), ay = fabsf(y);
+    float a = fminf(ax, ay) / fmaxf(fmaxf(ax, ay), FLT_MIN);
+    float s = a * a, r = 0;
+    unsigned int k;
+
+    for (k = 0; k < POLY_LEN(atan_poly); k++)
+        r = r * s + atan_poly[k];
+    r *= a;
+
+    if (ay > ax) r = M_PI_2 - r;
+    if (x < 0) r = M_PI - r;
+    return y < 0 ? -r : r;
+}
 
-static void adjust_ref(sync_t *st, unsigned int ref, int cfo)
+static void fast_sincosf(float x, float *s, float *c)
 {
-    unsigned int n;
+    // reduce to [-pi, pi], then evaluate at half the angle
+    float h = (x - truncf(x * (float) (0.5 / M_PI) + copysignf(0.5f, x)) * (float) (2 * M_PI)) * 0.5f;
+    float h2 = h * h, sh = 0, ch = 0;
+    unsigned int k;
+
+    for (k = 0; k < POLY_LEN(sin_poly); k++)
+        sh = sh * h2 + sin_poly[k];
+    for (k = 0; k < POLY_LEN(cos_poly); k++)
+        ch = ch * h2 + cos_poly[k];
+    sh *= h;
+
+    *s = 2 * sh * ch;
+    *c = 1 - 2 * sh * sh;
+}
+
+static void costas_generic(const sync_t *st, float (*re)[REF_LANES], float (*im)[REF_LANES], float (*phases)[REF_LANES],
+                           float *freq, float *phase, unsigned int start, unsigned int lanes, float cfo_freq)
+{
+    unsigned int n, r;
+
+    for (n = 0; n < BLKSZ; n++)
+    {
+        for (r = start; r < lanes; r++)
+        {
+            float s, c, x, y, error;
+
+            fast_sincosf(phase[r], &s, &c);
+            x = re[n][r] * c + im[n][r] * s;
+            y = im[n][r] * c - re[n][r] * s;
+            error = fast_atan2f(2 * x * y, x * x - y * y) * 0.5f;
+
+            phases[n][r] = phase[r];
+            re[n][r] = x;
+            im[n][r] = y;
+
+            freq[r] += st->beta * error;
+            if (freq[r] > 0.5) freq[r] = 0.5;
+            if (freq[r] < -0.5) freq[r] = -0.5;
+            phase[r] += freq[r] + cfo_freq + (st->alpha * error);
+            if (phase[r] > M_PI) phase[r] -= 2 * M_PI;
+            if (phase[r] < -M_PI) phase[r] += 2 * M_PI;
+        }
+    }
+}
+
+#ifdef HAVE_SSE2
+static inline __m128 select_sse2(__m128 mask, __m128 a, __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static void costas_sse2(const sync_t *st, float (*re)[REF_LANES], float (*im)[REF_LANES], float (*phases)[REF_LANES],
+                        float *freq, float *phase, unsigned int lanes, float cfo_freq)
+{
+    const __m128 sign = _mm_set1_ps(-0.0f), pi = _mm_set1_ps(M_PI), two_pi = _mm_set1_ps(2 * M_PI);
+    const __m128 alpha = _mm_set1_ps(st->alpha), beta = _mm_set1_ps(st->beta);
+    const __m128 freq_max = _mm_set1_ps(0.5f), freq_min = _mm_set1_ps(-0.5f);
+    unsigned int n, r, k;
+
+    for (r = 0; r + 4 <= lanes; r += 4)
+    {
+        __m128 f = _mm_load_ps(&freq[r]), p = _mm_load_ps(&phase[r]);
+
+        for (n = 0; n < BLKSZ; n++)
+        {
+            __m128 xr = _mm_load_ps(&re[n][r]), xi = _mm_load_ps(&im[n][r]);
+            __m128 h, h2, sh, ch, s, c, x, y, ax, ay, a, a2, e, t;
+
+            // sincos of the loop phase
+            t = _mm_add_ps(_mm_mul_ps(p, _mm_set1_ps(0.5 / M_PI)), _mm_or_ps(_mm_and_ps(p, sign), _mm_set1_ps(0.5f)));
+            h = _mm_mul_ps(_mm_sub_ps(p, _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(t)), two_pi)), _mm_set1_ps(0.5f));
+            h2 = _mm_mul_ps(h, h);
+            sh = _mm_setzero_ps();
+            for (k = 0; k < POLY_LEN(sin_poly); k++)
+                sh = _mm_add_ps(_mm_mul_ps(sh, h2), _mm_set1_ps(sin_poly[k]));
+            ch = _mm_setzero_ps();
+            for (k = 0; k < POLY_LEN(cos_poly); k++)
+                ch = _mm_add_ps(_mm_mul_ps(ch, h2), _mm_set1_ps(cos_poly[k]));
+            sh = _mm_mul_ps(sh, h);
+            s = _mm_mul_ps(_mm_add_ps(sh, sh), ch);
+            c = _mm_sub_ps(_mm_set1_ps(1), _mm_mul_ps(_mm_add_ps(sh, sh), sh));
+
+            // derotate
+            x = _mm_add_ps(_mm_mul_ps(xr, c), _mm_mul_ps(xi, s));
+            y = _mm_sub_ps(_mm_mul_ps(xi, c), _mm_mul_ps(xr, s));
+            _mm_store_ps(&phases[n][r], p);
+            _mm_store_ps(&re[n][r], x);
+            _mm_store_ps(&im[n][r], y);
+
+            // phase error, atan2(2xy, x^2 - y^2) / 2
+            t = _mm_mul_ps(_mm_add_ps(x, x), y);
+            x = _mm_sub_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y));
+            y = t;
+            ax = _mm_andnot_ps(sign, x);
+            ay = _mm_andnot_ps(sign, y);
+            a = _mm_div_ps(_mm_min_ps(ax, ay), _mm_max_ps(_mm_max_ps(ax, ay), _mm_set1_ps(FLT_MIN)));
+            a2 = _mm_mul_ps(a, a);
+            e = _mm_setzero_ps();
+            for (k = 0; k < POLY_LEN(atan_poly); k++)
+                e = _mm_add_ps(_mm_mul_ps(e, a2), _mm_set1_ps(atan_poly[k]));
+            e = _mm_mul_ps(e, a);
+            e = select_sse2(_mm_cmpgt_ps(ay, ax), _mm_sub_ps(_mm_set1_ps(M_PI_2), e), e);
+            e = select_sse2(_mm_cmplt_ps(x, _mm_setzero_ps()), _mm_sub_ps(pi, e), e);
+            e = _mm_xor_ps(e, _mm_and_ps(y, sign));
+            e = _mm_mul_ps(e, _mm_set1_ps(0.5f));
+
+            // loop filter
+            f = _mm_add_ps(f, _mm_mul_ps(beta, e));
+            f = _mm_max_ps(_mm_min_ps(f, freq_max), freq_min);
+            p = _mm_add_ps(p, _mm_add_ps(_mm_add_ps(f, _mm_set1_ps(cfo_freq)), _mm_mul_ps(alpha, e)));
+            p = _mm_sub_ps(p, _mm_and_ps(_mm_cmpgt_ps(p, pi), two_pi));
+            p = _mm_add_ps(p, _mm_and_ps(_mm_cmplt_ps(p, _mm_sub_ps(_mm_setzero_ps(), pi)), two_pi));
+        }
+
+        _mm_store_ps(&freq[r], f);
+        _mm_store_ps(&phase[r], p);
+    }
+
+    costas_generic(st, re, im, phases, freq, phase, r, lanes, cfo_freq);
+}
+#endif
+
+#ifdef HAVE_NEON
+static void costas_neon(const sync_t *st, float (*re)[REF_LANES], float (*im)[REF_LANES], float (*phases)[REF_LANES],
+                        float *freq, float *phase, unsigned int lanes, float cfo_freq)
+{
+    const float32x4_t pi = vdupq_n_f32(M_PI), two_pi = vdupq_n_f32(2 * M_PI);
+    const float32x4_t freq_max = vdupq_n_f32(0.5f), freq_min = vdupq_n_f32(-0.5f);
+    unsigned int n, r, k;
+
+    for (r = 0; r + 4 <= lanes; r += 4)
+    {
+        float32x4_t f = vld1q_f32(&freq[r]), p = vld1q_f32(&phase[r]);
+
+        for (n = 0; n < BLKSZ; n++)
+        {
+            float32x4_t xr = vld1q_f32(&re[n][r]), xi = vld1q_f32(&im[n][r]);
+            float32x4_t h, h2, sh, ch, s, c, x, y, ax, ay, a, a2, e, t, d;
+
+            // sincos of the loop phase
+            t = vbslq_f32(vcltq_f32(p, vdupq_n_f32(0)), vdupq_n_f32(-0.5f), vdupq_n_f32(0.5f));
+            t = vmlaq_n_f32(t, p, 0.5 / M_PI);
+            h = vmulq_n_f32(vmlsq_f32(p, vcvtq_f32_s32(vcvtq_s32_f32(t)), two_pi), 0.5f);
+            h2 = vmulq_f32(h, h);
+            sh = vdupq_n_f32(0);
+            for (k = 0; k < POLY_LEN(sin_poly); k++)
+                sh = vmlaq_f32(vdupq_n_f32(sin_poly[k]), sh, h2);
+            ch = vdupq_n_f32(0);
+            for (k = 0; k < POLY_LEN(cos_poly); k++)
+                ch = vmlaq_f32(vdupq_n_f32(cos_poly[k]), ch, h2);
+            sh = vmulq_f32(sh, h);
+            s = vmulq_f32(vaddq_f32(sh, sh), ch);
+            c = vmlsq_f32(vdupq_n_f32(1), vaddq_f32(sh, sh), sh);
+
+            // derotate
+            x = vmlaq_f32(vmulq_f32(xr, c), xi, s);
+            y = vmlsq_f32(vmulq_f32(xi, c), xr, s);
+            vst1q_f32(&phases[n][r], p);
+            vst1q_f32(&re[n][r], x);
+            vst1q_f32(&im[n][r], y);
+
+            // phase error, atan2(2xy, x^2 - y^2) / 2
+            t = vmulq_f32(vaddq_f32(x, x), y);
+            x = vmlsq_f32(vmulq_f32(x, x), y, y);
+            y = t;
+            ax = vabsq_f32(x);
+            ay = vabsq_f32(y);
+            // reciprocal estimate with two Newton-Raphson steps, as ARMv7
+            // has no vector division
+            d = vmaxq_f32(vmaxq_f32(ax, ay), vdupq_n_f32(FLT_MIN));
+            t = vrecpeq_f32(d);
+            t = vmulq_f32(t, vrecpsq_f32(d, t));
+            t = vmulq_f32(t, vrecpsq_f32(d, t));
+            a = vmulq_f32(vminq_f32(ax, ay), t);
+            a2 = vmulq_f32(a, a);
+            e = vdupq_n_f32(0);
+            for (k = 0; k < POLY_LEN(atan_poly); k++)
+                e = vmlaq_f32(vdupq_n_f32(atan_poly[k]), e, a2);
+            e = vmulq_f32(e, a);
+            e = vbslq_f32(vcgtq_f32(ay, ax), vsubq_f32(vdupq_n_f32(M_PI_2), e), e);
+            e = vbslq_f32(vcltq_f32(x, vdupq_n_f32(0)), vsubq_f32(pi, e), e);
+            e = vbslq_f32(vcltq_f32(y, vdupq_n_f32(0)), vnegq_f32(e), e);
+            e = vmulq_n_f32(e, 0.5f);
+
+            // loop filter
+            f = vmlaq_n_f32(f, e, st->beta);
+            f = vmaxq_f32(vminq_f32(f, freq_max), freq_min);
+            p = vaddq_f32(p, vmlaq_n_f32(vaddq_f32(f, vdupq_n_f32(cfo_freq)), e, st->alpha));
+            p = vbslq_f32(vcgtq_f32(p, pi), vsubq_f32(p, two_pi), p);
+            p = vbslq_f32(vcltq_f32(p, vnegq_f32(pi)), vaddq_f32(p, two_pi), p);
+        }
+
+        vst1q_f32(&freq[r], f);
+        vst1q_f32(&phase[r], p);
+    }
+
+    costas_generic(st, re, im, phases, freq, phase, r, lanes, cfo_freq);
+}
+#endif
+
+// Costas loops for a set of reference subcarriers. The loops are independent,
+// so each symbol is processed for several subcarriers at once, one per lane.
+static void adjust_refs(sync_t *st, const unsigned int *refs, unsigned int count, int cfo)
+{
+    float re[BLKSZ][REF_LANES] __attribute__((aligned(16)));
+    float im[BLKSZ][REF_LANES] __attribute__((aligned(16)));
+    float phases[BLKSZ][REF_LANES] __attribute__((aligned(16)));
+    float freq[REF_LANES] __attribute__((aligned(16)));
+    float phase[REF_LANES] __attribute__((aligned(16)));
     float cfo_freq = 2 * M_PI * cfo * CP / FFTCP;
+    unsigned int n, r;
 
     // sync bits (after DBPSK)
     static const signed char sync[] = {
         -1, 1, -1, -1, -1, 1, 1
     };
 
-    for (n = 0; n < BLKSZ; n++)
+    for (r = 0; r < count; r++)
     {
-        float error = cargf(st->buffer[ref][n] * st->buffer[ref][n] * cexpf(-I * 2 * st->costas_phase[ref])) * 0.5;
-
-        st->phases[ref][n] = st->costas_phase[ref];
-        st->buffer[ref][n] *= cexpf(-I * st->costas_phase[ref]);
-
-        st->costas_freq[ref] += st->beta * error;
-        if (st->costas_freq[ref] > 0.5) st->costas_freq[ref] = 0.5;
-        if (st->costas_freq[ref] < -0.5) st->costas_freq[ref] = -0.5;
-        st->costas_phase[ref] += st->costas_freq[ref] + cfo_freq + (st->alpha * error);
-        if (st->costas_phase[ref] > M_PI) st->costas_phase[ref] -= 2 * M_PI;
-        if (st->costas_phase[ref] < -M_PI) st->costas_phase[ref] += 2 * M_PI;
+        freq[r] = st->costas_freq[refs[r]];
+        phase[r] = st->costas_phase[refs[r]];
+        for (n = 0; n < BLKSZ; n++)
+        {
+            re[n][r] = crealf(st->buffer[refs[r]][n]);
+            im[n][r] = cimagf(st->buffer[refs[r]][n]);
+        }
     }
 
-    // compare to sync bits
-    float x = 0;
-    for (n = 0; n < sizeof(sync); n++)
-        x += crealf(st->buffer[ref][n]) * sync[n];
-    if (x < 0)
+#if defined(HAVE_SSE2)
+    costas_sse2(st, re, im, phases, freq, phase, count, cfo_freq);
+#elif defined(HAVE_NEON)
+    costas_neon(st, re, im, phases, freq, phase, count, cfo_freq);
+#else
+    costas_generic(st, re, im, phases, freq, phase, 0, count, cfo_freq);
+#endif
+
+    for (r = 0; r < count; r++)
     {
-        // adjust phase by pi to compensate
+        unsigned int ref = refs[r];
+        float x = 0, flip = 0;
+
+        // compare to sync bits, and adjust phase by pi to compensate if needed
+        for (n = 0; n < sizeof(sync); n++)
+            x += re[n][r] * sync[n];
+        if (x < 0)
+        {
+            flip = M_PI;
+            phase[r] += M_PI;
+        }
+
         for (n = 0; n < BLKSZ; n++)
         {
-            st->phases[ref][n] += M_PI;
-            st->buffer[ref][n] *= -1;
+            st->phases[ref][n] = phases[n][r] + flip;
+            st->buffer[ref][n] = x < 0 ? CMPLXF(-re[n][r], -im[n][r]) : CMPLXF(re[n][r], im[n][r]);
         }
-        st->costas_phase[ref] += M_PI;
+        st->costas_freq[ref] = freq[r];
+        st->costas_phase[ref] = phase[r];
     }
 }
 
@@ -137,25 +414,87 @@ static float calc_smag(sync_t *st, unsigned int ref)
     return sum / BLKSZ;
 }
 
-static void adjust_data(sync_t *st, unsigned int lower, unsigned int upper)
+// Equalize the data subcarriers between two reference subcarriers, using the
+// channel estimate interpolated between them. Returns the squared distance of
+// the equalized samples from the nearest constellation points, and adds the
+// same distance weighted by channel power to *noise.
+//
+// The samples are left weighted by channel power, so that each is
+// proportional to its log-likelihood ratio once divided by the noise level.
+static float adjust_data(sync_t *st, unsigned int lower, unsigned int upper, float *noise)
 {
+    float lower_re[BLKSZ], lower_im[BLKSZ], upper_re[BLKSZ], upper_im[BLKSZ];
+    float error[BLKSZ] = { 0 }, weighted_error[BLKSZ] = { 0 }, sum = 0;
     float smag0, smag19;
     smag0 = calc_smag(st, lower);
     smag19 = calc_smag(st, upper);
 
     for (int n = 0; n < BLKSZ; n++)
     {
-        float complex upper_phase = cexpf(st->phases[upper][n] * I);
-        float complex lower_phase = cexpf(st->phases[lower][n] * I);
+        float complex upper_phase = smag19 * cexpf(st->phases[upper][n] * I);
+        float complex lower_phase = smag0 * cexpf(st->phases[lower][n] * I);
+
+        upper_re[n] = crealf(upper_phase);
+        upper_im[n] = cimagf(upper_phase);
+        lower_re[n] = crealf(lower_phase);
+        lower_im[n] = cimagf(lower_phase);
+    }
+
+    // Each subcarrier is contiguous in time, so the loop over symbols is
+    // vectorized. It is written without complex types or branches, which
+    // would prevent that.
+    for (int k = 1; k < PARTITION_WIDTH; k++)
+    {
+        float *x = (float *) st->buffer[lower + k];
 
-        for (int k = 1; k < PARTITION_WIDTH; k++)
+        for (int n = 0; n < BLKSZ; n++)
         {
-            // average phase difference
-            float complex C = CMPLXF(PARTITION_WIDTH, PARTITION_WIDTH) / (k * smag19 * upper_phase + (PARTITION_WIDTH - k) * smag0 * lower_phase);
+            // average phase difference, d
+            float dr = k * upper_re[n] + (PARTITION_WIDTH - k) * lower_re[n];
+            float di = k * upper_im[n] + (PARTITION_WIDTH - k) * lower_im[n];
+            // C = (19 + 19i) / d = 19 (1 + i) conj(d) / |d|^2
+            float g = PARTITION_WIDTH / (dr * dr + di * di);
+            float cr = g * (dr + di), ci = g * (dr - di);
+            // channel power, relative to the reference subcarriers
+            float w = (dr * dr + di * di) / (PARTITION_WIDTH * PARTITION_WIDTH);
             // adjust sample
-            st->buffer[lower + k][n] *= C;
+            float yr = x[2 * n] * cr - x[2 * n + 1] * ci;
+            float yi = x[2 * n] * ci + x[2 * n + 1] * cr;
+            float e = (fabsf(yr) - 1) * (fabsf(yr) - 1) + (fabsf(yi) - 1) * (fabsf(yi) - 1);
+
+            error[n] += e;
+            weighted_error[n] += e * w;
+            x[2 * n] = yr * w;
+            x[2 * n + 1] = yi * w;
         }
     }
+
+    for (int n = 0; n < BLKSZ; n++)
+    {
+        sum += error[n];
+        *noise += weighted_error[n];
+    }
+    return sum;
+}
+
+static inline int8_t quantize(float x)
+{
+    return lrintf(fmaxf(fminf(x, 127), -127));
+}
+
+// soft bits for the data subcarriers of consecutive partitions
+static int8_t *demap(const sync_t *st, unsigned int n, unsigned int start, unsigned int partitions, float scale, int8_t *out)
+{
+    for (unsigned int i = start; i < start + partitions * PARTITION_WIDTH; i += PARTITION_WIDTH)
+    {
+        for (unsigned int j = 1; j < PARTITION_WIDTH; j++)
+        {
+            float complex c = st->buffer[i + j][n];
+            *out++ = quantize(crealf(c) * scale);
+            *out++ = quantize(cimagf(c) * scale);
+        }
+    }
+    return out;
 }
 
 float phase_diff(float a, float b)
@@ -169,9 +508,9 @@ float phase_diff(float a, float b)
 void sync_process(sync_t *st)
 {
     int i, partitions_per_band;
-    static int psmi = 1;
+    unsigned int refs[MAX_REF_CARRIERS], nrefs = 0;
 
-    switch (psmi) {
+    switch (st->psmi) {
         case 2:
             partitions_per_band = 11;
             break;
@@ -189,16 +528,17 @@ void sync_process(sync_t *st)
 
     for (i = 0; i < partitions_per_band * PARTITION_WIDTH + 1; i += PARTITION_WIDTH)
     {
-        adjust_ref(st, LB_START + i, 0);
-        adjust_ref(st, UB_END - i, 0);
+        refs[nrefs++] = LB(i);
+        refs[nrefs++] = UB(i);
     }
+    adjust_refs(st, refs, nrefs, 0);
 
     // check if we lost synchronization or now have it
     if (st->input->sync_state == SYNC_STATE_FINE)
     {
-        if (decode_get_block(&st->input->decode) == 0 && find_first_block(st, LB_START, &psmi) != 0)
+        if (decode_get_block(&st->input->decode) == 0 && find_first_block(st, LB(0), &st->psmi) != 0)
         {
-            if (find_first_block(st, UB_END, &psmi) != 0)
+            if (find_first_block(st, UB(0), &st->psmi) != 0)
             {
                 input_set_sync_state(st->input, SYNC_STATE_NONE);
             }
@@ -208,9 +548,9 @@ void sync_process(sync_t *st)
     {
         // First and last reference subcarriers have the same data. Try both
         // in case one of the sidebands is too corrupted.
-        int offset = find_first_block(st, LB_START, &psmi);
+        int offset = find_first_block(st, LB(0), &st->psmi);
         if (offset < 0)
-            offset = find_first_block(st, UB_END, &psmi);
+            offset = find_first_block(st, UB(0), &st->psmi);
 
         if (offset == 0)
         {
@@ -223,13 +563,15 @@ void sync_process(sync_t *st)
             for (i = -2 * PARTITION_WIDTH; i < 2 * PARTITION_WIDTH; ++i)
             {
                 int offset2;
-                adjust_ref(st, LB_START + (PM_PARTITIONS * PARTITION_WIDTH) + i, i);
-                offset = find_ref(st, LB_START + (PM_PARTITIONS * PARTITION_WIDTH) + i, 0);
+                unsigned int lower = LB(PM_PARTITIONS * PARTITION_WIDTH + i);
+                unsigned int upper = UB(PM_PARTITIONS * PARTITION_WIDTH - i);
+                adjust_refs(st, &lower, 1, i);
+                offset = find_ref(st, lower, 0);
                 if (offset < 0)
                     continue;
                 // We think we found the start. Check upperband to confirm.
-                adjust_ref(st, UB_END - (PM_PARTITIONS * PARTITION_WIDTH) + i, i);
-                offset2 = find_ref(st, UB_END - (PM_PARTITIONS * PARTITION_WIDTH) + i, 0);
+                adjust_refs(st, &upper, 1, i);
+                offset2 = find_ref(st, upper, 0);
                 if (offset2 == offset)
                 {
                     // The offsets matched, so 'i' is likely the CFO.
@@ -256,13 +598,14 @@ void sync_process(sync_t *st)
     {
         float samperr = 0, angle = 0;
         float sum_xy = 0, sum_x2 = 0;
+        float error_lb = 0, error_ub = 0, noise_lb = 0, noise_ub = 0;
         for (i = 0; i < partitions_per_band * PARTITION_WIDTH; i += PARTITION_WIDTH)
         {
-            adjust_data(st, LB_START + i, LB_START + i + PARTITION_WIDTH);
-            adjust_data(st, UB_END - i - PARTITION_WIDTH, UB_END - i);
+            error_lb += adjust_data(st, LB(i), LB(i + PARTITION_WIDTH), &noise_lb);
+            error_ub += adjust_data(st, UB(i + PARTITION_WIDTH), UB(i), &noise_ub);
 
-            samperr += phase_diff(st->phases[LB_START + i][0], st->phases[LB_START + i + PARTITION_WIDTH][0]);
-            samperr += phase_diff(st->phases[UB_END - i - PARTITION_WIDTH][0], st->phases[UB_END - i][0]);
+            samperr += phase_diff(st->phases[LB(i)][0], st->phases[LB(i + PARTITION_WIDTH)][0]);
+            samperr += phase_diff(st->phases[UB(i + PARTITION_WIDTH)][0], st->phases[UB(i)][0]);
         }
         samperr = samperr / (partitions_per_band * 2) * FFT / PARTITION_WIDTH / (2 * M_PI);
 
@@ -271,13 +614,13 @@ void sync_process(sync_t *st)
             float x, y;
 
             x = LB_START + i - (FFT / 2);
-            y = st->costas_freq[LB_START + i];
+            y = st->costas_freq[LB(i)];
             angle += y;
             sum_xy += x * y;
             sum_x2 += x * x;
 
             x = UB_END - i - (FFT / 2);
-            y = st->costas_freq[UB_END - i];
+            y = st->costas_freq[UB(i)];
             angle += y;
             sum_xy += x * y;
             sum_x2 += x * x;
@@ -288,27 +631,6 @@ void sync_process(sync_t *st)
         angle /= (partitions_per_band + 1) * 2;
         st->angle = angle;
 
-        // Calculate modulation error
-        float error_lb = 0, error_ub = 0;
-        for (int n = 0; n < BLKSZ; n++)
-        {
-            float complex c, ideal;
-            for (i = 0; i < partitions_per_band * PARTITION_WIDTH; i += PARTITION_WIDTH)
-            {
-                unsigned int j;
-                for (j = 1; j < PARTITION_WIDTH; j++)
-                {
-                    c = st->buffer[LB_START + i + j][n];
-                    ideal = CMPLXF(crealf(c) >= 0 ? 1 : -1, cimagf(c) >= 0 ? 1 : -1);
-                    error_lb += normf(ideal - c);
-
-                    c = st->buffer[UB_END - i - PARTITION_WIDTH + j][n];
-                    ideal = CMPLXF(crealf(c) >= 0 ? 1 : -1, cimagf(c) >= 0 ? 1 : -1);
-                    error_ub += normf(ideal - c);
-                }
-            }
-        }
-
         st->error_lb += error_lb;
         st->error_ub += error_ub;
 
@@ -326,101 +648,66 @@ void sync_process(sync_t *st)
             st->error_ub = 0;
         }
 
-        // Soft demod based on MER for each sideband
-        float mer_lb = 2 * BLKSZ * (partitions_per_band * PARTITION_DATA_CARRIERS) / error_lb;
-        float mer_ub = 2 * BLKSZ * (partitions_per_band * PARTITION_DATA_CARRIERS) / error_ub;
-        float mult_lb = fmaxf(fminf(mer_lb * 10, 127), 1);
-        float mult_ub = fmaxf(fminf(mer_ub * 10, 127), 1);
-
-#define DEMOD(x) ((x) >= 0 ? 1 : -1)
+        // Soft demod: for QPSK each bit has LLR = 2 * y / sigma^2, where y is
+        // the equalized sample and sigma^2 the noise variance on it. The noise
+        // before equalization is estimated for each sideband, and sigma^2 for
+        // each sample follows from the channel power the sample is weighted by.
+        float samples = 2 * BLKSZ * (partitions_per_band * PARTITION_DATA_CARRIERS);
+        float scale_lb = 2 * LLR_SCALE / fmaxf(noise_lb / samples, FLT_MIN);
+        float scale_ub = 2 * LLR_SCALE / fmaxf(noise_ub / samples, FLT_MIN);
+
+        decode_t *decode = &st->input->decode;
+        int8_t *pm = decode_get_pm_block(decode);
+        int8_t *px1 = decode_get_px1_block(decode);
         for (int n = 0; n < BLKSZ; n++)
         {
-            float complex c;
-            for (i = LB_START; i < LB_START + (PM_PARTITIONS * PARTITION_WIDTH); i += PARTITION_WIDTH)
-            {
-                unsigned int j;
-                for (j = 1; j < PARTITION_WIDTH; j++)
-                {
-                    c = st->buffer[i + j][n];
-                    decode_push_pm(&st->input->decode, DEMOD(crealf(c)) * mult_lb);
-                    decode_push_pm(&st->input->decode, DEMOD(cimagf(c)) * mult_lb);
-                }
-            }
-            for (i = UB_END - (PM_PARTITIONS * PARTITION_WIDTH); i < UB_END; i += PARTITION_WIDTH)
+            pm = demap(st, n, LB(0), PM_PARTITIONS, scale_lb, pm);
+            pm = demap(st, n, UB(PM_PARTITIONS * PARTITION_WIDTH), PM_PARTITIONS, scale_ub, pm);
+            if (st->psmi == 3)
             {
-                unsigned int j;
-                for (j = 1; j < PARTITION_WIDTH; j++)
-                {
-                    c = st->buffer[i + j][n];
-                    decode_push_pm(&st->input->decode, DEMOD(crealf(c)) * mult_ub);
-                    decode_push_pm(&st->input->decode, DEMOD(cimagf(c)) * mult_ub);
-                }
-            }
-            if (psmi == 3) {
-                for (i = LB_START + (PM_PARTITIONS * PARTITION_WIDTH); i < LB_START + (PM_PARTITIONS + 2) * PARTITION_WIDTH; i += PARTITION_WIDTH)
-                {
-                    unsigned int j;
-                    for (j = 1; j < PARTITION_WIDTH; j++)
-                    {
-                        c = st->buffer[i + j][n];
-                        decode_push_px1(&st->input->decode, DEMOD(crealf(c)) * mult_lb);
-                        decode_push_px1(&st->input->decode, DEMOD(cimagf(c)) * mult_lb);
-                    }
-                }
-                for (i = UB_END - (PM_PARTITIONS + 2) * PARTITION_WIDTH; i < UB_END - (PM_PARTITIONS * PARTITION_WIDTH); i += PARTITION_WIDTH)
-                {
-                    unsigned int j;
-                    for (j = 1; j < PARTITION_WIDTH; j++)
-                    {
-                        c = st->buffer[i + j][n];
-                        decode_push_px1(&st->input->decode, DEMOD(crealf(c)) * mult_ub);
-                        decode_push_px1(&st->input->decode, DEMOD(cimagf(c)) * mult_ub);
-                    }
-                }
+                px1 = demap(st, n, LB(PM_PARTITIONS * PARTITION_WIDTH), 2, scale_lb, px1);
+                px1 = demap(st, n, UB((PM_PARTITIONS + 2) * PARTITION_WIDTH), 2, scale_ub, px1);
             }
         }
+        decode_push_pm_block(decode);
+        if (st->psmi == 3)
+            decode_push_px1_block(decode);
     }
 }
 
 void sync_adjust(sync_t *st, int sample_adj)
 {
-    int i;
-    for (i = 0; i < MAX_PARTITIONS * PARTITION_WIDTH + 1; i++)
-    {
-        st->costas_phase[LB_START + i] -= sample_adj * (LB_START + i - (FFT / 2)) * 2 * M_PI / FFT;
-        st->costas_phase[UB_END - i] -= sample_adj * (UB_END - i - (FFT / 2)) * 2 * M_PI / FFT;
-    }
+    unsigned int c;
+    for (c = 0; c < SYNC_CARRIERS; c++)
+        st->costas_phase[c] -= sample_adj * (carrier_bin(c) - (FFT / 2)) * 2 * M_PI / FFT;
 }
 
-void sync_push(sync_t *st, float complex *fftout)
+// called with the FFT output of BLKSZ symbols, one per row
+void sync_push_block(sync_t *st, float complex (*symbols)[FFT])
 {
-    unsigned int i;
-    for (i = 0; i < MAX_PARTITIONS * PARTITION_WIDTH + 1; i++)
-    {
-        st->buffer[LB_START + i][st->idx] = fftout[LB_START + i];
-        st->buffer[UB_END - i][st->idx] = fftout[UB_END - i];
-    }
+    unsigned int c, n;
 
-    if (++st->idx == BLKSZ)
+    // keep only the active subcarriers, transposed so that each one is
+    // contiguous in time
+    for (c = 0; c < SYNC_CARRIERS; c++)
     {
-        st->idx = 0;
-
-        sync_process(st);
+        int bin = carrier_bin(c);
+        for (n = 0; n < BLKSZ; n++)
+            st->buffer[c][n] = symbols[n][bin];
     }
+
+    sync_process(st);
 }
 
 void sync_reset(sync_t *st)
 {
-    unsigned int i;
-    for (i = 0; i < MAX_PARTITIONS * PARTITION_WIDTH + 1; i++)
+    unsigned int c;
+    for (c = 0; c < SYNC_CARRIERS; c++)
     {
-        st->costas_freq[LB_START + i] = 0;
-        st->costas_phase[LB_START + i] = 0;
-        st->costas_freq[UB_END - i] = 0;
-        st->costas_phase[UB_END - i] = 0;
+        st->costas_freq[c] = 0;
+        st->costas_phase[c] = 0;
     }
 
-    st->idx = 0;
     st->cfo_wait = 0;
     st->mer_cnt = 0;
     st->error_lb = 0;
@@ -435,5 +722,6 @@ void sync_init(sync_t *st, input_t *input)
     st->beta = (4 * loop_bw * loop_bw) / denom;
 
     st->input = input;
+    st->psmi = 1;
     sync_reset(st);
 }
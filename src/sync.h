@@ -4,20 +4,30 @@
 
 #include <complex.h>
 
+#include "defines.h"
+
+#define MAX_PARTITIONS 14
+#define PARTITION_WIDTH 19
+// subcarriers per sideband, from the outermost reference subcarrier inwards
+#define SIDEBAND_CARRIERS (MAX_PARTITIONS * PARTITION_WIDTH + 1)
+// subcarriers kept in the sync buffer: lower sideband, then upper sideband
+#define SYNC_CARRIERS (SIDEBAND_CARRIERS * 2)
+#define MAX_REF_CARRIERS ((MAX_PARTITIONS + 1) * 2)
+
 typedef struct
 {
     struct input_t *input;
-    float complex buffer[FFT][BLKSZ];
-    float phases[FFT][BLKSZ];
-    unsigned int idx;
+    float complex buffer[SYNC_CARRIERS][BLKSZ];
+    float phases[SYNC_CARRIERS][BLKSZ];
     int cfo_wait;
     int samperr;
     float angle;
+    int psmi;
 
     float alpha;
     float beta;
-    float costas_freq[FFT];
-    float costas_phase[FFT];
+    float costas_freq[SYNC_CARRIERS];
+    float costas_phase[SYNC_CARRIERS];
 
     int mer_cnt;
     float error_lb;
@@ -25,6 +35,6 @@ typedef struct
 } sync_t;
 
 void sync_adjust(sync_t *st, int sample_adj);
-void sync_push(sync_t *st, float complex *fft);
+void sync_push_block(sync_t *st, float complex (*symbols)[FFT]);
 void sync_reset(sync_t *st);
 void sync_init(sync_t *st, struct input_t *input);
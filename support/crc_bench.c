@@ -0,0 +1,269 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Micro-benchmark of the packet CRCs
+ *
+ * Compares crc8, fcs16 and crc12 from crc.c with the byte-at-a-time and
+ * bit-at-a-time versions they replaced, checking that the results agree.
+ *
+ *     crc_bench [sizes-file]
+ *
+ * Packet sizes are drawn from models of the traffic each CRC sees: audio
+ * packets of 32-96 kbps programs for crc8, PSD and AAS HDLC frames for
+ * fcs16, and PIDS blocks for crc12. A file of sizes in bytes, one per
+ * line (for example logged while decoding a capture), replaces the models
+ * for crc8 and fcs16.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "crc.h"
+
+#define PACKETS 20000
+#define MAX_PACKET 2048
+#define ROUNDS 50
+
+typedef struct
+{
+    const char *name;
+    unsigned int min, max;
+} model_t;
+
+static const model_t audio_model = { "audio packets", 150, 450 };
+static const model_t psd_model = { "PSD frames", 16, 128 };
+static const model_t aas_model = { "AAS frames", 64, 512 };
+
+static uint8_t old_crc8_tab[256];
+static uint16_t old_fcs_tab[256];
+
+static void old_init(void)
+{
+    for (unsigned int i = 0; i < 256; i++)
+    {
+        uint8_t c = i;
+        uint16_t f = i;
+
+        for (int k = 0; k < 8; k++)
+        {
+            c = (c & 0x80) ? (c << 1) ^ 0x31 : c << 1;
+            f = (f & 1) ? (f >> 1) ^ 0x8408 : f >> 1;
+        }
+        old_crc8_tab[i] = c;
+        old_fcs_tab[i] = f;
+    }
+}
+
+static uint8_t old_crc8(const uint8_t *pkt, unsigned int cnt)
+{
+    unsigned int i, crc = 0xFF;
+    for (i = 0; i < cnt; ++i)
+        crc = old_crc8_tab[crc ^ pkt[i]];
+    return crc;
+}
+
+static uint16_t old_fcs16(const uint8_t *cp, int len)
+{
+    uint16_t crc = 0xFFFF;
+    while (len--)
+        crc = (crc >> 8) ^ old_fcs_tab[(crc ^ *cp++) & 0xFF];
+    return (crc);
+}
+
+static uint16_t old_crc12(const uint8_t *bits)
+{
+    uint16_t poly = 0xD010;
+    uint16_t reg = 0x0000;
+    int i, lowbit;
+
+    for (i = 67; i >= 0; i--)
+    {
+        lowbit = reg & 1;
+        reg >>= 1;
+        reg ^= ((uint16_t)bits[i] << 15);
+        if (lowbit) reg ^= poly;
+    }
+    for (i = 0; i < 16; i++)
+    {
+        lowbit = reg & 1;
+        reg >>= 1;
+        if (lowbit) reg ^= poly;
+    }
+    reg ^= 0x955;
+    return reg & 0xfff;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned int load_sizes(const char *name, unsigned int *sizes)
+{
+    FILE *fp = fopen(name, "r");
+    unsigned int n = 0, len;
+
+    if (!fp)
+        return 0;
+    while (n < PACKETS && fscanf(fp, "%u", &len) == 1)
+    {
+        if (len > 0 && len <= MAX_PACKET)
+            sizes[n++] = len;
+    }
+    fclose(fp);
+    return n;
+}
+
+static void model_sizes(const model_t *m, unsigned int *sizes)
+{
+    for (unsigned int i = 0; i < PACKETS; i++)
+        sizes[i] = m->min + rand() % (m->max - m->min + 1);
+}
+
+static void report(const char *crc, const char *name, const unsigned int *sizes, unsigned int n,
+                   double t_old, double t_new, int mismatches)
+{
+    uint64_t bytes = 0;
+
+    for (unsigned int i = 0; i < n; i++)
+        bytes += sizes[i];
+    printf("%-6s %-14s %5.0f B avg  old %7.1f ns  new %7.1f ns  %5.2fx%s\n",
+           crc, name, (double) bytes / n,
+           t_old * 1e9 / (n * ROUNDS), t_new * 1e9 / (n * ROUNDS), t_old / t_new,
+           mismatches ? "  MISMATCH" : "");
+}
+
+static void bench_crc8(const char *name, const uint8_t *data, const unsigned int *sizes, unsigned int n)
+{
+    volatile unsigned int sink = 0;
+    int mismatches = 0;
+    double t0, t_old, t_new;
+
+    for (unsigned int i = 0; i < n; i++)
+        mismatches += old_crc8(data, sizes[i]) != crc8(data, sizes[i]);
+
+    t0 = now();
+    for (int r = 0; r < ROUNDS; r++)
+        for (unsigned int i = 0; i < n; i++)
+            sink += old_crc8(data + (i & 255), sizes[i]);
+    t_old = now() - t0;
+
+    t0 = now();
+    for (int r = 0; r < ROUNDS; r++)
+        for (unsigned int i = 0; i < n; i++)
+            sink += crc8(data + (i & 255), sizes[i]);
+    t_new = now() - t0;
+
+    report("crc8", name, sizes, n, t_old, t_new, mismatches);
+}
+
+static void bench_fcs16(const char *name, const uint8_t *data, const unsigned int *sizes, unsigned int n)
+{
+    volatile unsigned int sink = 0;
+    int mismatches = 0;
+    double t0, t_old, t_new;
+
+    for (unsigned int i = 0; i < n; i++)
+        mismatches += old_fcs16(data, sizes[i]) != fcs16(data, sizes[i]);
+
+    t0 = now();
+    for (int r = 0; r < ROUNDS; r++)
+        for (unsigned int i = 0; i < n; i++)
+            sink += old_fcs16(data + (i & 255), sizes[i]);
+    t_old = now() - t0;
+
+    t0 = now();
+    for (int r = 0; r < ROUNDS; r++)
+        for (unsigned int i = 0; i < n; i++)
+            sink += fcs16(data + (i & 255), sizes[i]);
+    t_new = now() - t0;
+
+    report("fcs16", name, sizes, n, t_old, t_new, mismatches);
+}
+
+static void bench_crc12(const uint8_t *data)
+{
+    static uint8_t bits[PACKETS][68];
+    static unsigned int sizes[PACKETS];
+    volatile unsigned int sink = 0;
+    int mismatches = 0;
+    double t0, t_old, t_new;
+
+    // the old function took the frame unpacked into one bit per byte
+    for (unsigned int i = 0; i < PACKETS; i++)
+    {
+        for (int b = 0; b < 68; b++)
+            bits[i][b] = (data[i + b / 8] >> (7 - b % 8)) & 1;
+        sizes[i] = 10;
+        mismatches += old_crc12(bits[i]) != crc12(data + i);
+    }
+
+    t0 = now();
+    for (int r = 0; r < ROUNDS; r++)
+        for (unsigned int i = 0; i < PACKETS; i++)
+            sink += old_crc12(bits[i]);
+    t_old = now() - t0;
+
+    t0 = now();
+    for (int r = 0; r < ROUNDS; r++)
+        for (unsigned int i = 0; i < PACKETS; i++)
+            sink += crc12(data + i);
+    t_new = now() - t0;
+
+    report("crc12", "PIDS blocks", sizes, PACKETS, t_old, t_new, mismatches);
+}
+
+int main(int argc, char *argv[])
+{
+    static uint8_t data[PACKETS + MAX_PACKET];
+    static unsigned int sizes[PACKETS];
+    unsigned int n;
+
+    srand(1);
+    for (unsigned int i = 0; i < sizeof(data); i++)
+        data[i] = rand();
+
+    old_init();
+    crc_init();
+
+    if (argc > 1)
+    {
+        n = load_sizes(argv[1], sizes);
+        if (n == 0)
+        {
+            fprintf(stderr, "No packet sizes in %s\n", argv[1]);
+            return 1;
+        }
+        bench_crc8(argv[1], data, sizes, n);
+        bench_fcs16(argv[1], data, sizes, n);
+    }
+    else
+    {
+        model_sizes(&audio_model, sizes);
+        bench_crc8(audio_model.name, data, sizes, PACKETS);
+        model_sizes(&psd_model, sizes);
+        bench_fcs16(psd_model.name, data, sizes, PACKETS);
+        model_sizes(&aas_model, sizes);
+        bench_fcs16(aas_model.name, data, sizes, PACKETS);
+    }
+    bench_crc12(data);
+
+    return 0;
+}
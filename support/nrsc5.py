@@ -109,6 +109,12 @@ class ProgramType(enum.Enum):
     SPECIAL_READING_SERVICES = 76
 
 
+class ScanType(enum.Enum):
+    NONE = 0
+    ANALOG = 1
+    HYBRID = 2
+
+
 IQ = collections.namedtuple("IQ", ["data"])
 MER = collections.namedtuple("MER", ["lower", "upper"])
 BER = collections.namedtuple("BER", ["cber"])
@@ -127,6 +133,16 @@ SISAudioService = collections.namedtuple("SISAudioService", ["program", "access"
 SISDataService = collections.namedtuple("SISDataService", ["access", "type", "mime_type"])
 SIS = collections.namedtuple("SIS", ["country_code", "fcc_facility_id", "name", "slogan", "message", "alert",
                                      "latitude", "longitude", "altitude", "audio_services", "data_services"])
+ScanResult = collections.namedtuple("ScanResult", ["freq", "type", "cnr", "time"])
+
+
+class _ScanResult(ctypes.Structure):
+    _fields_ = [
+        ("freq", ctypes.c_float),
+        ("type", ctypes.c_int),
+        ("cnr", ctypes.c_float),
+        ("time", ctypes.c_float),
+    ]
 
 
 class _IQ(ctypes.Structure):
@@ -493,6 +509,33 @@ class NRSC5:
     def set_auto_gain(self, enabled):
         NRSC5.libnrsc5.nrsc5_set_auto_gain(self.radio, int(enabled))
 
+    def get_dropped_frames(self):
+        count = ctypes.c_uint()
+        NRSC5.libnrsc5.nrsc5_get_dropped_frames(self.radio, ctypes.byref(count))
+        return count.value
+
+    def set_ber_interval(self, interval):
+        NRSC5.libnrsc5.nrsc5_set_ber_interval(self.radio, int(interval))
+
+    def set_buffers(self, ring_size, usb_count, usb_length):
+        result = NRSC5.libnrsc5.nrsc5_set_buffers(self.radio, int(ring_size), int(usb_count), int(usb_length))
+        if result != 0:
+            raise NRSC5Error("Failed to set buffers.")
+
+    def get_ring_stats(self):
+        overruns = ctypes.c_uint()
+        high_water = ctypes.c_uint()
+        NRSC5.libnrsc5.nrsc5_get_ring_stats(self.radio, ctypes.byref(overruns), ctypes.byref(high_water))
+        return overruns.value, high_water.value
+
+    def scan(self, max_results=128):
+        results = (_ScanResult * max_results)()
+        count = ctypes.c_uint(max_results)
+        result = NRSC5.libnrsc5.nrsc5_scan(self.radio, results, ctypes.byref(count))
+        if result != 0:
+            raise NRSC5Error("Failed to scan.")
+        return [ScanResult(r.freq, ScanType(r.type), r.cnr, r.time) for r in results[:count.value]]
+
     def _set_callback(self):
         def callback_closure(evt, opaque):
             self._callback_wrapper(evt)
@@ -513,3 +556,104 @@ class NRSC5:
         result = NRSC5.libnrsc5.nrsc5_pipe_samples_cs16(self.radio, samples, len(samples) // 2)
         if result != 0:
             raise NRSC5Error("Failed to pipe samples.")
+
+    def pipe_samples_cs8(self, samples):
+        if len(samples) % 2 != 0:
+            raise NRSC5Error("len(samples) must be a multiple of 2.")
+        result = NRSC5.libnrsc5.nrsc5_pipe_samples_cs8(self.radio, samples, len(samples))
+        if result != 0:
+            raise NRSC5Error("Failed to pipe samples.")
+
+    def pipe_samples_cf32(self, samples):
+        if len(samples) % 8 != 0:
+            raise NRSC5Error("len(samples) must be a multiple of 8.")
+        result = NRSC5.libnrsc5.nrsc5_pipe_samples_cf32(self.radio, samples, len(samples) // 4)
+        if result != 0:
+            raise NRSC5Error("Failed to pipe samples.")
+
+    def set_sample_rate(self, sample_rate):
+        result = NRSC5.libnrsc5.nrsc5_set_sample_rate(self.radio, int(sample_rate))
+        if result != 0:
+            raise NRSC5Error("Failed to set sample rate.")
+
+
+class Channelizer:
+    def __init__(self):
+        NRSC5._load_library(self)
+        self.channelizer = ctypes.c_void_p()
+        self.radios = []
+
+    def open(self, sample_rate, center_freq):
+        result = NRSC5.libnrsc5.nrsc5_channelizer_open(ctypes.byref(self.channelizer), sample_rate,
+                                                       ctypes.c_float(center_freq))
+        if result != 0:
+            raise NRSC5Error("Failed to open channelizer.")
+
+    def close(self):
+        NRSC5.libnrsc5.nrsc5_channelizer_close(self.channelizer)
+        self.radios = []
+
+    def add_station(self, freq, callback):
+        radio = NRSC5(callback)
+        result = NRSC5.libnrsc5.nrsc5_channelizer_add_station(self.channelizer, ctypes.c_float(freq),
+                                                              ctypes.byref(radio.radio))
+        if result != 0:
+            raise NRSC5Error("Failed to add station.")
+        radio._set_callback()
+        self.radios.append(radio)
+        return radio
+
+    def pipe_samples_cs16(self, samples):
+        if len(samples) % 4 != 0:
+            raise NRSC5Error("len(samples) must be a multiple of 4.")
+        result = NRSC5.libnrsc5.nrsc5_channelizer_pipe_samples_cs16(self.channelizer, samples, len(samples) // 2)
+        if result != 0:
+            raise NRSC5Error("Failed to pipe samples.")
+
+    def pipe_samples_cf32(self, samples):
+        if len(samples) % 8 != 0:
+            raise NRSC5Error("len(samples) must be a multiple of 8.")
+        result = NRSC5.libnrsc5.nrsc5_channelizer_pipe_samples_cf32(self.channelizer, samples, len(samples) // 4)
+        if result != 0:
+            raise NRSC5Error("Failed to pipe samples.")
+
+
+class Scan:
+    def __init__(self):
+        NRSC5._load_library(self)
+        self.scan = ctypes.c_void_p()
+
+    def open(self, sample_rate, center_freq):
+        result = NRSC5.libnrsc5.nrsc5_scan_open(ctypes.byref(self.scan), sample_rate, ctypes.c_float(center_freq))
+        if result != 0:
+            raise NRSC5Error("Failed to open scan.")
+
+    def close(self):
+        NRSC5.libnrsc5.nrsc5_scan_close(self.scan)
+
+    def pipe_samples_cu8(self, samples):
+        if len(samples) % 2 != 0:
+            raise NRSC5Error("len(samples) must be a multiple of 2.")
+        result = NRSC5.libnrsc5.nrsc5_scan_pipe_samples_cu8(self.scan, samples, len(samples))
+        if result != 0:
+            raise NRSC5Error("Failed to pipe samples.")
+
+    def pipe_samples_cs16(self, samples):
+        if len(samples) % 4 != 0:
+            raise NRSC5Error("len(samples) must be a multiple of 4.")
+        result = NRSC5.libnrsc5.nrsc5_scan_pipe_samples_cs16(self.scan, samples, len(samples) // 2)
+        if result != 0:
+            raise NRSC5Error("Failed to pipe samples.")
+
+    def pipe_samples_cf32(self, samples):
+        if len(samples) % 8 != 0:
+            raise NRSC5Error("len(samples) must be a multiple of 8.")
+        result = NRSC5.libnrsc5.nrsc5_scan_pipe_samples_cf32(self.scan, samples, len(samples) // 4)
+        if result != 0:
+            raise NRSC5Error("Failed to pipe samples.")
+
+    def get_results(self, max_results=128):
+        results = (_ScanResult * max_results)()
+        count = ctypes.c_uint(max_results)
+        NRSC5.libnrsc5.nrsc5_scan_get_results(self.scan, results, ctypes.byref(count))
+        return [ScanResult(r.freq, ScanType(r.type), r.cnr, r.time) for r in results[:count.value]]
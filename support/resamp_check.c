@@ -0,0 +1,169 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Level check of the resampler
+ *
+ * Synthesizes the same in-band tones as cu8 at the native sample rate and
+ * at other rates, and compares the demodulator input produced by the
+ * halfband decimator with that of the resampler. A loud cf32 capture is
+ * then resampled to check that peaks saturate instead of wrapping around.
+ *
+ *     resamp_check
+ *
+ * Exits with a non-zero status if a check fails.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "firdecim_q15.h"
+#include "resamp.h"
+
+// seconds of input per check
+#define DURATION 0.1
+// output samples skipped while the filters settle
+#define SETTLE 1024
+// allowed difference in RMS level, in dB
+#define MAX_LEVEL_DIFF 0.5
+
+// halfband taps of the native cu8 path, as in input.c
+static float decim_taps[] = {
+    0.6062333583831787,
+    -0.13481467962265015,
+    0.032919470220804214,
+    -0.00410953676328063
+};
+
+static const unsigned int rates[] = { 2048000, 2400000, 3000000 };
+
+// two tones within the HD Radio sidebands
+static float complex tones(double t, float amplitude)
+{
+    return amplitude * (cexpf(I * (float) (2 * M_PI * 150000.0 * t))
+                        + cexpf(I * (float) (2 * M_PI * -110000.0 * t)));
+}
+
+static uint8_t *make_cu8(unsigned int rate, unsigned int count)
+{
+    uint8_t *buf = malloc(count * 2);
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        float complex x = tones((double) i / rate, 0.3f);
+        buf[i * 2] = (uint8_t) lrintf(crealf(x) * 127 + 127);
+        buf[i * 2 + 1] = (uint8_t) lrintf(cimagf(x) * 127 + 127);
+    }
+    return buf;
+}
+
+static double rms_db(const cint16_t *y, unsigned int count)
+{
+    double sum = 0;
+
+    for (unsigned int i = SETTLE; i < count; i++)
+        sum += (double) y[i].r * y[i].r + (double) y[i].i * y[i].i;
+    return 10 * log10(sum / (count - SETTLE));
+}
+
+static double native_level(void)
+{
+    unsigned int count = (unsigned int) (SAMPLE_RATE * DURATION) & ~1u;
+    uint8_t *buf = make_cu8(SAMPLE_RATE, count);
+    cint16_t *y = malloc(sizeof(cint16_t) * count);
+    firdecim_q15 q = firdecim_q15_create(decim_taps, sizeof(decim_taps) / sizeof(decim_taps[0]));
+    unsigned int n = firdecim_q15_execute_block(q, buf, count * 2, y);
+    double level = rms_db(y, n);
+
+    firdecim_q15_free(q);
+    free(y);
+    free(buf);
+    return level;
+}
+
+static double resamp_level(unsigned int rate)
+{
+    unsigned int count = (unsigned int) (rate * DURATION);
+    uint8_t *buf = make_cu8(rate, count);
+    resamp q = resamp_create(rate, 0);
+    cint16_t *y = malloc(sizeof(cint16_t) * resamp_max_output(q, count));
+    unsigned int n = resamp_execute_cu8(q, buf, count, y);
+    double level = rms_db(y, n);
+
+    resamp_free(q);
+    free(y);
+    free(buf);
+    return level;
+}
+
+static cint16_t *resample_cf32(unsigned int rate, float amplitude, unsigned int *n)
+{
+    unsigned int count = (unsigned int) (rate * DURATION);
+    float complex *x = malloc(sizeof(float complex) * count);
+    resamp q = resamp_create(rate, 0);
+    cint16_t *y = malloc(sizeof(cint16_t) * resamp_max_output(q, count));
+
+    for (unsigned int i = 0; i < count; i++)
+        x[i] = tones((double) i / rate, amplitude);
+    *n = resamp_execute(q, x, count, y);
+
+    resamp_free(q);
+    free(x);
+    return y;
+}
+
+// count loud output samples whose sign differs from a quiet reference
+static unsigned int count_wraps(unsigned int rate, float amplitude)
+{
+    unsigned int n, wraps = 0;
+    cint16_t *ref = resample_cf32(rate, 0.01f, &n);
+    cint16_t *y = resample_cf32(rate, amplitude, &n);
+
+    for (unsigned int i = 0; i < n; i++)
+    {
+        if ((abs(ref[i].r) > 16 && (ref[i].r < 0) != (y[i].r < 0))
+            || (abs(ref[i].i) > 16 && (ref[i].i < 0) != (y[i].i < 0)))
+            wraps++;
+    }
+
+    free(y);
+    free(ref);
+    return wraps;
+}
+
+int main(void)
+{
+    double native = native_level();
+    unsigned int wraps;
+    int failed = 0;
+
+    printf("cu8    %7u S/s  %6.2f dB\n", SAMPLE_RATE, native);
+    for (unsigned int i = 0; i < sizeof(rates) / sizeof(rates[0]); i++)
+    {
+        double level = resamp_level(rates[i]);
+        int ok = fabs(level - native) <= MAX_LEVEL_DIFF;
+
+        printf("cu8    %7u S/s  %6.2f dB  %s\n", rates[i], level, ok ? "ok" : "MISMATCH");
+        failed |= !ok;
+    }
+
+    // far beyond the output headroom, so the resampler must saturate
+    wraps = count_wraps(2400000, 4.0f);
+    printf("cf32   %7u S/s  %u wraparounds  %s\n", 2400000, wraps, wraps == 0 ? "ok" : "FAILED");
+    failed |= wraps != 0;
+
+    return failed;
+}